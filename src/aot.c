@@ -0,0 +1,450 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "chip_8.h"
+
+// Decoded with chip_8_load, so the translation sees exactly the instructions
+// chip_8_emulate_cycle would.
+static chip_8 emu;
+
+static const char *op_names[CHIP_8_OP_COUNT] = {
+    [CHIP_8_OP_CLS] = "CHIP_8_OP_CLS",
+    [CHIP_8_OP_RET] = "CHIP_8_OP_RET",
+    [CHIP_8_OP_JP] = "CHIP_8_OP_JP",
+    [CHIP_8_OP_CALL] = "CHIP_8_OP_CALL",
+    [CHIP_8_OP_SE_BYTE] = "CHIP_8_OP_SE_BYTE",
+    [CHIP_8_OP_SNE_BYTE] = "CHIP_8_OP_SNE_BYTE",
+    [CHIP_8_OP_SE_REG] = "CHIP_8_OP_SE_REG",
+    [CHIP_8_OP_LD_BYTE] = "CHIP_8_OP_LD_BYTE",
+    [CHIP_8_OP_ADD_BYTE] = "CHIP_8_OP_ADD_BYTE",
+    [CHIP_8_OP_LD_REG] = "CHIP_8_OP_LD_REG",
+    [CHIP_8_OP_OR_REG] = "CHIP_8_OP_OR_REG",
+    [CHIP_8_OP_AND_REG] = "CHIP_8_OP_AND_REG",
+    [CHIP_8_OP_XOR_REG] = "CHIP_8_OP_XOR_REG",
+    [CHIP_8_OP_ADD_REG] = "CHIP_8_OP_ADD_REG",
+    [CHIP_8_OP_SUB_REG] = "CHIP_8_OP_SUB_REG",
+    [CHIP_8_OP_SHR] = "CHIP_8_OP_SHR",
+    [CHIP_8_OP_SUBN_REG] = "CHIP_8_OP_SUBN_REG",
+    [CHIP_8_OP_SHL] = "CHIP_8_OP_SHL",
+    [CHIP_8_OP_SNE_REG] = "CHIP_8_OP_SNE_REG",
+    [CHIP_8_OP_LD_ADDR] = "CHIP_8_OP_LD_ADDR",
+    [CHIP_8_OP_JP_REL] = "CHIP_8_OP_JP_REL",
+    [CHIP_8_OP_RND] = "CHIP_8_OP_RND",
+    [CHIP_8_OP_DRW] = "CHIP_8_OP_DRW",
+    [CHIP_8_OP_SKP] = "CHIP_8_OP_SKP",
+    [CHIP_8_OP_SKNP] = "CHIP_8_OP_SKNP",
+    [CHIP_8_OP_LD_DT] = "CHIP_8_OP_LD_DT",
+    [CHIP_8_OP_LD_K] = "CHIP_8_OP_LD_K",
+    [CHIP_8_OP_LD_DT_REG] = "CHIP_8_OP_LD_DT_REG",
+    [CHIP_8_OP_LD_ST_REG] = "CHIP_8_OP_LD_ST_REG",
+    [CHIP_8_OP_ADD_I_REG] = "CHIP_8_OP_ADD_I_REG",
+    [CHIP_8_OP_LD_F_REG] = "CHIP_8_OP_LD_F_REG",
+    [CHIP_8_OP_LD_B_REG] = "CHIP_8_OP_LD_B_REG",
+    [CHIP_8_OP_LD_I_REG] = "CHIP_8_OP_LD_I_REG",
+    [CHIP_8_OP_LD_REG_I] = "CHIP_8_OP_LD_REG_I",
+    [CHIP_8_OP_UNKNOWN] = "CHIP_8_OP_UNKNOWN",
+};
+
+// Addresses reachable from 0x200 that hold a translatable instruction.
+static bool translated[MEMORY_SIZE];
+
+static void explore(size_t end) {
+    static uint16_t work[2 * MEMORY_SIZE];
+    size_t top = 0;
+
+    work[top++] = 0x200;
+
+    while (top > 0) {
+        uint16_t addr = work[--top];
+        if (addr < 0x200 || addr + 2 > end || translated[addr]) {
+            continue;
+        }
+
+        const chip_8_insn *insn = &emu._code[addr];
+
+        switch (insn->op) {
+        case CHIP_8_OP_UNKNOWN:
+            break;
+        case CHIP_8_OP_RET:
+        case CHIP_8_OP_JP_REL:
+            translated[addr] = true;
+            break;
+        case CHIP_8_OP_JP:
+            translated[addr] = true;
+            work[top++] = insn->nnn;
+            break;
+        case CHIP_8_OP_CALL:
+            translated[addr] = true;
+            work[top++] = insn->nnn;
+            work[top++] = addr + 2;
+            break;
+        case CHIP_8_OP_SE_BYTE:
+        case CHIP_8_OP_SNE_BYTE:
+        case CHIP_8_OP_SE_REG:
+        case CHIP_8_OP_SNE_REG:
+        case CHIP_8_OP_SKP:
+        case CHIP_8_OP_SKNP:
+            translated[addr] = true;
+            work[top++] = addr + 2;
+            work[top++] = addr + 4;
+            break;
+        default:
+            translated[addr] = true;
+            work[top++] = addr + 2;
+            break;
+        }
+    }
+}
+
+// Continues at target, directly if it is translated.
+static void emit_goto(FILE *out, uint16_t target) {
+    if (target < MEMORY_SIZE && translated[target]) {
+        fprintf(out, "    goto L_%03x;\n", target);
+    } else {
+        fprintf(out, "    EXIT(0x%03x);\n", target);
+    }
+}
+
+static void emit_skip(FILE *out, uint16_t addr, const char *cond) {
+    fprintf(out, "    if (%s) {\n    ", cond);
+    emit_goto(out, addr + 4);
+    fprintf(out, "    }\n");
+    emit_goto(out, addr + 2);
+}
+
+// Emits the body of the instruction at addr, mirroring its _chip_8_* handler
+// statement for statement so that VF aliasing behaves identically. Returns
+// false if control cannot fall through to addr + 2.
+static bool emit_insn(FILE *out, uint16_t addr) {
+    const chip_8_insn *insn = &emu._code[addr];
+    char cond[64];
+
+    switch (insn->op) {
+    case CHIP_8_OP_CLS:
+        fprintf(out, "    _chip_8_cls(emu, &insn_%03x);\n", addr);
+        fprintf(out, "    *draw = true;\n");
+        fprintf(out, "    EXIT(0x%03x);\n", addr + 2);
+        return false;
+    case CHIP_8_OP_RET:
+        fprintf(out, "    if (emu->_sp == 0) {\n");
+        fprintf(out, "        BAIL(0x%03x);\n", addr);
+        fprintf(out, "    }\n");
+        fprintf(out, "    emu->_sp--;\n");
+        fprintf(out, "    emu->_pc = emu->_stack[emu->_sp] + 2;\n");
+        fprintf(out, "    goto dispatch;\n");
+        return false;
+    case CHIP_8_OP_JP:
+        emit_goto(out, insn->nnn);
+        return false;
+    case CHIP_8_OP_CALL:
+        fprintf(out, "    if (emu->_sp >= STACK_SIZE) {\n");
+        fprintf(out, "        BAIL(0x%03x);\n", addr);
+        fprintf(out, "    }\n");
+        fprintf(out, "    emu->_stack[emu->_sp] = 0x%03x;\n", addr);
+        fprintf(out, "    emu->_sp++;\n");
+        emit_goto(out, insn->nnn);
+        return false;
+    case CHIP_8_OP_SE_BYTE:
+    case CHIP_8_OP_SNE_BYTE:
+        snprintf(cond,
+            sizeof(cond),
+            "emu->_V[%d] %s 0x%02x",
+            insn->x,
+            insn->op == CHIP_8_OP_SE_BYTE ? "==" : "!=",
+            insn->kk);
+        emit_skip(out, addr, cond);
+        return false;
+    case CHIP_8_OP_SE_REG:
+    case CHIP_8_OP_SNE_REG:
+        snprintf(cond,
+            sizeof(cond),
+            "emu->_V[%d] %s emu->_V[%d]",
+            insn->x,
+            insn->op == CHIP_8_OP_SE_REG ? "==" : "!=",
+            insn->y);
+        emit_skip(out, addr, cond);
+        return false;
+    case CHIP_8_OP_SKP:
+    case CHIP_8_OP_SKNP:
+        snprintf(cond,
+            sizeof(cond),
+            "emu->_keymap[emu->_V[%d] & KEY_MASK] %s 0",
+            insn->x,
+            insn->op == CHIP_8_OP_SKP ? "!=" : "==");
+        emit_skip(out, addr, cond);
+        return false;
+    case CHIP_8_OP_LD_BYTE:
+        fprintf(out, "    emu->_V[%d] = 0x%02x;\n", insn->x, insn->kk);
+        return true;
+    case CHIP_8_OP_ADD_BYTE:
+        fprintf(out,
+            "    emu->_V[%d] = emu->_V[%d] + 0x%02x;\n",
+            insn->x,
+            insn->x,
+            insn->kk);
+        return true;
+    case CHIP_8_OP_LD_REG:
+        fprintf(out, "    emu->_V[%d] = emu->_V[%d];\n", insn->x, insn->y);
+        return true;
+    case CHIP_8_OP_OR_REG:
+    case CHIP_8_OP_AND_REG:
+    case CHIP_8_OP_XOR_REG:
+        fprintf(out,
+            "    emu->_V[%d] = emu->_V[%d] %c emu->_V[%d];\n",
+            insn->x,
+            insn->x,
+            insn->op == CHIP_8_OP_OR_REG    ? '|'
+            : insn->op == CHIP_8_OP_AND_REG ? '&'
+                                            : '^',
+            insn->y);
+        return true;
+    case CHIP_8_OP_ADD_REG:
+        fprintf(out,
+            "    emu->_V[0xF] = emu->_V[%d] + emu->_V[%d] > 255;\n",
+            insn->x,
+            insn->y);
+        fprintf(out,
+            "    emu->_V[%d] = emu->_V[%d] + emu->_V[%d];\n",
+            insn->x,
+            insn->x,
+            insn->y);
+        return true;
+    case CHIP_8_OP_SUB_REG:
+        fprintf(out,
+            "    emu->_V[0xF] = emu->_V[%d] < emu->_V[%d];\n",
+            insn->x,
+            insn->y);
+        fprintf(out,
+            "    emu->_V[%d] = emu->_V[%d] - emu->_V[%d];\n",
+            insn->x,
+            insn->x,
+            insn->y);
+        return true;
+    case CHIP_8_OP_SHR:
+        fprintf(out, "    emu->_V[0xF] = emu->_V[%d] & 0x1;\n", insn->x);
+        fprintf(out, "    emu->_V[%d] = emu->_V[%d] >> 1;\n", insn->x, insn->x);
+        return true;
+    case CHIP_8_OP_SUBN_REG:
+        fprintf(out,
+            "    emu->_V[0xF] = !(emu->_V[%d] > emu->_V[%d]);\n",
+            insn->x,
+            insn->y);
+        fprintf(out,
+            "    emu->_V[%d] = emu->_V[%d] - emu->_V[%d];\n",
+            insn->x,
+            insn->y,
+            insn->x);
+        return true;
+    case CHIP_8_OP_SHL:
+        fprintf(out, "    emu->_V[0xF] = emu->_V[%d] >> 7;\n", insn->x);
+        fprintf(out, "    emu->_V[%d] = emu->_V[%d] << 1;\n", insn->x, insn->x);
+        return true;
+    case CHIP_8_OP_LD_ADDR:
+        fprintf(out, "    emu->_I = 0x%03x;\n", insn->nnn);
+        return true;
+    case CHIP_8_OP_JP_REL:
+        fprintf(out, "    emu->_pc = emu->_V[0x0] + 0x%03x;\n", insn->nnn);
+        fprintf(out, "    goto dispatch;\n");
+        return false;
+    case CHIP_8_OP_DRW:
+        fprintf(out, "    _chip_8_drw(emu, &insn_%03x);\n", addr);
+        fprintf(out, "    *draw = true;\n");
+        fprintf(out, "    EXIT(0x%03x);\n", addr + 2);
+        return false;
+    case CHIP_8_OP_LD_DT:
+        fprintf(out, "    SYNC();\n");
+        fprintf(out, "    emu->_V[%d] = emu->_delay_timer;\n", insn->x);
+        return true;
+    case CHIP_8_OP_LD_K:
+        fprintf(out, "    if (!_chip_8_ld_k(emu, &insn_%03x)) {\n", addr);
+        fprintf(out, "        cycles--;\n");
+        fprintf(out, "        EXIT(0x%03x);\n", addr);
+        fprintf(out, "    }\n");
+        return true;
+    case CHIP_8_OP_LD_DT_REG:
+        fprintf(out, "    SYNC();\n");
+        fprintf(out, "    emu->_delay_timer = emu->_V[%d];\n", insn->x);
+        return true;
+    case CHIP_8_OP_LD_ST_REG:
+        fprintf(out, "    SYNC();\n");
+        fprintf(out, "    emu->_sound_timer = emu->_V[%d];\n", insn->x);
+        return true;
+    case CHIP_8_OP_ADD_I_REG:
+        fprintf(out,
+            "    emu->_V[0xF] = emu->_I + emu->_V[%d] > 0xFFF;\n",
+            insn->x);
+        fprintf(out, "    emu->_I += emu->_V[%d];\n", insn->x);
+        return true;
+    case CHIP_8_OP_LD_F_REG:
+        fprintf(out, "    emu->_I = emu->_V[%d] * 0x5;\n", insn->x);
+        return true;
+    case CHIP_8_OP_RND:
+        fprintf(out, "    _chip_8_rnd(emu, &insn_%03x);\n", addr);
+        return true;
+    case CHIP_8_OP_LD_B_REG:
+        fprintf(out, "    _chip_8_ld_b_reg(emu, &insn_%03x);\n", addr);
+        return true;
+    case CHIP_8_OP_LD_I_REG:
+        fprintf(out, "    _chip_8_ld_i_reg(emu, &insn_%03x);\n", addr);
+        return true;
+    case CHIP_8_OP_LD_REG_I:
+        fprintf(out, "    _chip_8_ld_reg_i(emu, &insn_%03x);\n", addr);
+        return true;
+    }
+    return false;
+}
+
+// Instructions that are executed through their handler need the decoded
+// record as a constant.
+static bool needs_record(uint8_t op) {
+    return op == CHIP_8_OP_CLS || op == CHIP_8_OP_DRW || op == CHIP_8_OP_LD_K ||
+           op == CHIP_8_OP_RND || op == CHIP_8_OP_LD_B_REG ||
+           op == CHIP_8_OP_LD_I_REG || op == CHIP_8_OP_LD_REG_I;
+}
+
+static void emit(FILE *out, const char *path, size_t end) {
+    fprintf(out, "// Generated by chip8-aot from %s. Do not edit.\n\n", path);
+    fprintf(out, "#include \"chip_8_aot.h\"\n\n");
+
+    fprintf(out, "const uint8_t chip_8_aot_rom[] = {");
+    for (size_t i = 0x200; i < end; i++) {
+        const char *sep = (i - 0x200) % 12 ? " " : "\n    ";
+        fprintf(out, "%s0x%02x,", sep, emu._memory[i]);
+    }
+    fprintf(out, "\n};\n");
+    fprintf(out,
+        "const size_t chip_8_aot_rom_size = sizeof(chip_8_aot_rom);\n\n");
+
+    // Every instruction first checks the cycle budget and that memory still
+    // holds the opcode it was translated from; timers are caught up lazily.
+    // Instructions that would fault are left uncounted to the interpreter,
+    // which raises the fault.
+    fprintf(out,
+        "#define EXIT(addr) \\\n"
+        "    do { \\\n"
+        "        emu->_pc = addr; \\\n"
+        "        goto done; \\\n"
+        "    } while (0)\n\n"
+        "#define STEP(addr, opcode) \\\n"
+        "    if (cycles == max_cycles || \\\n"
+        "        emu->_memory[addr] != (opcode) >> 8 || \\\n"
+        "        emu->_memory[addr + 1] != ((opcode) & 0xFF)) { \\\n"
+        "        EXIT(addr); \\\n"
+        "    } \\\n"
+        "    cycles++\n\n"
+        "#define BAIL(addr) \\\n"
+        "    do { \\\n"
+        "        cycles--; \\\n"
+        "        EXIT(addr); \\\n"
+        "    } while (0)\n\n"
+        "#define SYNC() \\\n"
+        "    do { \\\n"
+        "        _chip_8_advance(emu, cycles - 1 - ticked); \\\n"
+        "        ticked = cycles - 1; \\\n"
+        "    } while (0)\n\n");
+
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        const chip_8_insn *insn = &emu._code[addr];
+        if (translated[addr] && needs_record(insn->op)) {
+            fprintf(out,
+                "static const chip_8_insn insn_%03zx = "
+                "{0x%04x, 0x%03x, %s, %d, %d, 0x%02x, %d};\n",
+                addr,
+                insn->opcode,
+                insn->nnn,
+                op_names[insn->op],
+                insn->x,
+                insn->y,
+                insn->kk,
+                insn->n);
+        }
+    }
+
+    fprintf(out,
+        "\nuint32_t chip_8_aot_run(chip_8 *emu, uint32_t max_cycles, "
+        "bool *draw) {\n");
+    fprintf(out, "    uint32_t cycles = 0;\n");
+    fprintf(out, "    uint32_t ticked = 0;\n\n");
+    fprintf(out, "    *draw = false;\n\n");
+    fprintf(out, "    if (emu->_fault != CHIP_8_FAULT_NONE) {\n");
+    fprintf(out, "        return 0;\n");
+    fprintf(out, "    }\n\n");
+
+    // Only returns and computed jumps come back to the switch.
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        uint8_t op = emu._code[addr].op;
+        if (translated[addr] &&
+            (op == CHIP_8_OP_RET || op == CHIP_8_OP_JP_REL)) {
+            fprintf(out, "dispatch:\n");
+            break;
+        }
+    }
+    fprintf(out, "    switch (emu->_pc) {\n");
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (translated[addr]) {
+            fprintf(out,
+                "    case 0x%03zx:\n        goto L_%03zx;\n",
+                addr,
+                addr);
+        }
+    }
+    fprintf(out, "    default:\n        goto done;\n    }\n");
+
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (!translated[addr]) {
+            continue;
+        }
+
+        fprintf(out, "\nL_%03zx:\n", addr);
+        fprintf(out,
+            "    STEP(0x%03zx, 0x%04x);\n",
+            addr,
+            emu._code[addr].opcode);
+
+        if (emit_insn(out, addr)) {
+            size_t next = addr + 1;
+            while (next < MEMORY_SIZE && !translated[next]) {
+                next++;
+            }
+            if (next != addr + 2) {
+                emit_goto(out, addr + 2);
+            }
+        }
+    }
+
+    fprintf(out, "\ndone:\n");
+    fprintf(out, "    _chip_8_advance(emu, cycles - ticked);\n");
+    fprintf(out, "    return cycles;\n}\n");
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr,
+            "Invalid arguments. Usage: ./chip8-aot <path-to-rom> <output.c>\n");
+        return 1;
+    }
+
+    chip_8_init(&emu);
+    if (!chip_8_load(&emu, argv[1])) {
+        fprintf(stderr, "Failed to load ROM\n");
+        return 1;
+    }
+
+    FILE *rom = fopen(argv[1], "rb");
+    fseek(rom, 0, SEEK_END);
+    size_t end = 0x200 + ftell(rom);
+    fclose(rom);
+
+    explore(end);
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open output: %s\n", argv[2]);
+        return 1;
+    }
+
+    emit(out, argv[1], end);
+    fclose(out);
+
+    return 0;
+}
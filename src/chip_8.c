@@ -4,8 +4,9 @@
 #include <string.h>
 
 #include "chip_8.h"
+#include "chip_8_profile.h"
 
-uint8_t chip_8_fontset[FONTSET_SIZE] = {
+static const uint8_t chip_8_fontset[FONTSET_SIZE] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
     0x20, 0x60, 0x20, 0x20, 0x70, // 1
     0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
@@ -24,6 +25,251 @@ uint8_t chip_8_fontset[FONTSET_SIZE] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80  // F
 };
 
+static void _chip_8_unknown(chip_8 *emu, const chip_8_insn *insn) {
+    emu->_fault = CHIP_8_FAULT_UNKNOWN_OPCODE;
+}
+
+#ifdef CHIP_8_DISPATCH_TABLE
+typedef void (*chip_8_handler)(chip_8 *emu, const chip_8_insn *insn);
+
+// Handlers indexed by instruction class. Fx0A is handled by the dispatcher
+// itself, since waiting for a key has to stall the whole cycle.
+static const chip_8_handler chip_8_handlers[CHIP_8_OP_COUNT] = {
+    [CHIP_8_OP_CLS] = _chip_8_cls,
+    [CHIP_8_OP_RET] = _chip_8_ret,
+    [CHIP_8_OP_JP] = _chip_8_jp,
+    [CHIP_8_OP_CALL] = _chip_8_call,
+    [CHIP_8_OP_SE_BYTE] = _chip_8_se_byte,
+    [CHIP_8_OP_SNE_BYTE] = _chip_8_sne_byte,
+    [CHIP_8_OP_SE_REG] = _chip_8_se_reg,
+    [CHIP_8_OP_LD_BYTE] = _chip_8_ld_byte,
+    [CHIP_8_OP_ADD_BYTE] = _chip_8_add_byte,
+    [CHIP_8_OP_LD_REG] = _chip_8_ld_reg,
+    [CHIP_8_OP_OR_REG] = _chip_8_or_reg,
+    [CHIP_8_OP_AND_REG] = _chip_8_and_reg,
+    [CHIP_8_OP_XOR_REG] = _chip_8_xor_reg,
+    [CHIP_8_OP_ADD_REG] = _chip_8_add_reg,
+    [CHIP_8_OP_SUB_REG] = _chip_8_sub_reg,
+    [CHIP_8_OP_SHR] = _chip_8_shr,
+    [CHIP_8_OP_SUBN_REG] = _chip_8_subn_reg,
+    [CHIP_8_OP_SHL] = _chip_8_shl,
+    [CHIP_8_OP_SNE_REG] = _chip_8_sne_reg,
+    [CHIP_8_OP_LD_ADDR] = _chip_8_ld_addr,
+    [CHIP_8_OP_JP_REL] = _chip_8_jp_rel,
+    [CHIP_8_OP_RND] = _chip_8_rnd,
+    [CHIP_8_OP_DRW] = _chip_8_drw,
+    [CHIP_8_OP_SKP] = _chip_8_skp,
+    [CHIP_8_OP_SKNP] = _chip_8_sknp,
+    [CHIP_8_OP_LD_DT] = _chip_8_ld_dt,
+    [CHIP_8_OP_LD_K] = NULL,
+    [CHIP_8_OP_LD_DT_REG] = _chip_8_ld_dt_reg,
+    [CHIP_8_OP_LD_ST_REG] = _chip_8_ld_st_reg,
+    [CHIP_8_OP_ADD_I_REG] = _chip_8_add_i_reg,
+    [CHIP_8_OP_LD_F_REG] = _chip_8_ld_f_reg,
+    [CHIP_8_OP_LD_B_REG] = _chip_8_ld_b_reg,
+    [CHIP_8_OP_LD_I_REG] = _chip_8_ld_i_reg,
+    [CHIP_8_OP_LD_REG_I] = _chip_8_ld_reg_i,
+    [CHIP_8_OP_UNKNOWN] = _chip_8_unknown,
+};
+#endif
+
+static void _chip_8_decode_insn(chip_8_insn *insn, uint16_t opcode) {
+    insn->opcode = opcode;
+    insn->nnn = opcode & 0x0FFF;
+    insn->op = chip_8_decode(opcode);
+    insn->x = (opcode & 0x0F00) >> 8;
+    insn->y = (opcode & 0x00F0) >> 4;
+    insn->kk = opcode & 0x00FF;
+    insn->n = opcode & 0x000F;
+}
+
+static void _chip_8_flush_blocks(chip_8 *emu) {
+    emu->_block_count = 0;
+    memset(emu->_block_map, 0, sizeof(emu->_block_map));
+    memset(emu->_block_cover, 0, sizeof(emu->_block_cover));
+    emu->_block_flushes++;
+}
+
+static void _chip_8_decode_at(chip_8 *emu, size_t addr) {
+    // The instruction at the last address wraps around to memory[0].
+    uint8_t low = emu->_memory[(addr + 1) & ADDR_MASK];
+    _chip_8_decode_insn(&emu->_code[addr], emu->_memory[addr] << 8 | low);
+}
+
+void _chip_8_predecode(chip_8 *emu, size_t addr, size_t len) {
+    if (len == 0) {
+        return;
+    }
+
+    // A write past the end of memory continues at address 0.
+    if (addr + len > MEMORY_SIZE) {
+        _chip_8_predecode(emu, 0, addr + len - MEMORY_SIZE);
+        len = MEMORY_SIZE - addr;
+    }
+
+    size_t end = addr + len;
+    bool flush = false;
+
+    // The instruction starting one byte earlier also contains memory[addr].
+    _chip_8_decode_at(emu, (addr - 1) & ADDR_MASK);
+
+    for (size_t i = addr; i < end; i++) {
+        _chip_8_decode_at(emu, i);
+        flush |= emu->_block_cover[i];
+    }
+
+    if (flush) {
+        _chip_8_flush_blocks(emu);
+    }
+
+    size_t last = (end - 1) / CODE_PAGE_SIZE;
+    for (size_t page = addr / CODE_PAGE_SIZE; page <= last; page++) {
+        emu->_page_writes[page]++;
+    }
+}
+
+// Returns the decoded instruction at the program counter, which wraps around
+// at the end of memory like every other address.
+static inline const chip_8_insn *_chip_8_fetch(const chip_8 *emu) {
+    return &emu->_code[emu->_pc & ADDR_MASK];
+}
+
+// Executes a single decoded instruction other than Fx0A, which has to be
+// able to stall and is handled by the callers.
+static inline void _chip_8_dispatch(chip_8 *emu, const chip_8_insn *insn) {
+#ifdef CHIP_8_DISPATCH_TABLE
+    chip_8_handlers[insn->op](emu, insn);
+#else
+    switch (insn->op) {
+    case CHIP_8_OP_CLS:
+        _chip_8_cls(emu, insn);
+        break;
+    case CHIP_8_OP_RET:
+        _chip_8_ret(emu, insn);
+        break;
+    case CHIP_8_OP_JP:
+        _chip_8_jp(emu, insn);
+        break;
+    case CHIP_8_OP_CALL:
+        _chip_8_call(emu, insn);
+        break;
+    case CHIP_8_OP_SE_BYTE:
+        _chip_8_se_byte(emu, insn);
+        break;
+    case CHIP_8_OP_SNE_BYTE:
+        _chip_8_sne_byte(emu, insn);
+        break;
+    case CHIP_8_OP_SE_REG:
+        _chip_8_se_reg(emu, insn);
+        break;
+    case CHIP_8_OP_LD_BYTE:
+        _chip_8_ld_byte(emu, insn);
+        break;
+    case CHIP_8_OP_ADD_BYTE:
+        _chip_8_add_byte(emu, insn);
+        break;
+    case CHIP_8_OP_LD_REG:
+        _chip_8_ld_reg(emu, insn);
+        break;
+    case CHIP_8_OP_OR_REG:
+        _chip_8_or_reg(emu, insn);
+        break;
+    case CHIP_8_OP_AND_REG:
+        _chip_8_and_reg(emu, insn);
+        break;
+    case CHIP_8_OP_XOR_REG:
+        _chip_8_xor_reg(emu, insn);
+        break;
+    case CHIP_8_OP_ADD_REG:
+        _chip_8_add_reg(emu, insn);
+        break;
+    case CHIP_8_OP_SUB_REG:
+        _chip_8_sub_reg(emu, insn);
+        break;
+    case CHIP_8_OP_SHR:
+        _chip_8_shr(emu, insn);
+        break;
+    case CHIP_8_OP_SUBN_REG:
+        _chip_8_subn_reg(emu, insn);
+        break;
+    case CHIP_8_OP_SHL:
+        _chip_8_shl(emu, insn);
+        break;
+    case CHIP_8_OP_SNE_REG:
+        _chip_8_sne_reg(emu, insn);
+        break;
+    case CHIP_8_OP_LD_ADDR:
+        _chip_8_ld_addr(emu, insn);
+        break;
+    case CHIP_8_OP_JP_REL:
+        _chip_8_jp_rel(emu, insn);
+        break;
+    case CHIP_8_OP_RND:
+        _chip_8_rnd(emu, insn);
+        break;
+    case CHIP_8_OP_DRW:
+        _chip_8_drw(emu, insn);
+        break;
+    case CHIP_8_OP_SKP:
+        _chip_8_skp(emu, insn);
+        break;
+    case CHIP_8_OP_SKNP:
+        _chip_8_sknp(emu, insn);
+        break;
+    case CHIP_8_OP_LD_DT:
+        _chip_8_ld_dt(emu, insn);
+        break;
+    case CHIP_8_OP_LD_DT_REG:
+        _chip_8_ld_dt_reg(emu, insn);
+        break;
+    case CHIP_8_OP_LD_ST_REG:
+        _chip_8_ld_st_reg(emu, insn);
+        break;
+    case CHIP_8_OP_ADD_I_REG:
+        _chip_8_add_i_reg(emu, insn);
+        break;
+    case CHIP_8_OP_LD_F_REG:
+        _chip_8_ld_f_reg(emu, insn);
+        break;
+    case CHIP_8_OP_LD_B_REG:
+        _chip_8_ld_b_reg(emu, insn);
+        break;
+    case CHIP_8_OP_LD_I_REG:
+        _chip_8_ld_i_reg(emu, insn);
+        break;
+    case CHIP_8_OP_LD_REG_I:
+        _chip_8_ld_reg_i(emu, insn);
+        break;
+    default:
+        _chip_8_unknown(emu, insn);
+        break;
+    }
+#endif
+}
+
+// As _chip_8_dispatch, profiled as a whole in PROFILE=1 builds.
+static inline void _chip_8_execute(chip_8 *emu, const chip_8_insn *insn) {
+    PROFILE(emu, insn->op, _chip_8_dispatch(emu, insn));
+}
+
+static inline void _chip_8_update_timers(chip_8 *emu) {
+    emu->_cycles++;
+    emu->_timer_phase += TIMER_HZ;
+
+    if (emu->_timer_phase < emu->_ips) {
+        return;
+    }
+    emu->_timer_phase -= emu->_ips;
+
+    if (emu->_delay_timer) {
+        emu->_delay_timer--;
+    }
+
+    if (emu->_sound_timer > 0) {
+        emu->_sound_timer--;
+    }
+}
+
 void chip_8_init(chip_8 *emu) {
     emu->_I = 0;
     emu->_sp = 0;
@@ -33,22 +279,60 @@ void chip_8_init(chip_8 *emu) {
 
     memset(emu->_memory, 0, MEMORY_SIZE);
     memset(emu->_V, 0, REGISTERS);
-    memset(emu->_stack, 0, STACK_SIZE);
-    memset(emu->_framebuffer, 0, FB_SIZE);
+    memset(emu->_stack, 0, sizeof(emu->_stack));
+    memset(emu->_framebuffer, 0, sizeof(emu->_framebuffer));
     memset(emu->_keymap, 0, KEYMAP_SIZE);
+    emu->_dirty_rows = UINT32_MAX;
 
     emu->_sound_timer = 0;
     emu->_delay_timer = 0;
 
+    emu->_cycles = 0;
+    emu->_ips = DEFAULT_IPS;
+    emu->_quirks = 0;
+    emu->_timer_phase = 0;
+
+    chip_8_seed(emu, DEFAULT_SEED);
+    emu->_fault = CHIP_8_FAULT_NONE;
+
     for (size_t i = 0; i < FONTSET_SIZE; i++) {
         emu->_memory[i] = chip_8_fontset[i];
     }
+
+    _chip_8_flush_blocks(emu);
+    emu->_block_flushes = 0;
+
+    memset(emu->_page_writes, 0, sizeof(emu->_page_writes));
+
+#ifdef CHIP_8_PROFILE
+    chip_8_profile_reset(emu);
+#endif
+
+    _chip_8_predecode(emu, 0, MEMORY_SIZE);
+}
+
+void _chip_8_write_memory(chip_8 *emu, const uint8_t *image) {
+    for (size_t addr = 0; addr < MEMORY_SIZE;) {
+        if (emu->_memory[addr] == image[addr]) {
+            addr++;
+            continue;
+        }
+
+        size_t first = addr;
+        while (addr < MEMORY_SIZE && emu->_memory[addr] != image[addr]) {
+            addr++;
+        }
+
+        memcpy(emu->_memory + first, image + first, addr - first);
+        _chip_8_predecode(emu, first, addr - first);
+    }
 }
 
 bool chip_8_load(chip_8 *emu, const char *path) {
     FILE *file = fopen(path, "rb");
     if (file == NULL) {
         fprintf(stderr, "Failed to open ROM: %s\n", path);
+        return false;
     }
 
     fseek(file, 0, SEEK_END);
@@ -75,219 +359,999 @@ bool chip_8_load(chip_8 *emu, const char *path) {
     }
 
     fclose(file);
+
+    _chip_8_predecode(emu, 512, file_size);
+    return true;
+}
+
+bool chip_8_load_rom(chip_8 *emu, const uint8_t *rom, size_t size) {
+    if (size > MAX_FILE_SIZE) {
+        fprintf(stderr,
+            "Rom exceeds memory size. Max size: %d, ROM size: %d\n",
+            MAX_FILE_SIZE,
+            (int)size);
+        return false;
+    }
+
+    memcpy(emu->_memory + 512, rom, size);
+
+    _chip_8_predecode(emu, 512, size);
     return true;
 }
 
 bool chip_8_emulate_cycle(chip_8 *emu) {
-    emu->_opcode = emu->_memory[emu->_pc] << 8 | emu->_memory[emu->_pc + 1];
+    if (emu->_fault != CHIP_8_FAULT_NONE) {
+        return false;
+    }
 
-    bool draw = false;
+    const chip_8_insn *insn = _chip_8_fetch(emu);
+    chip_8_op op = insn->op;
 
-    switch (emu->_opcode & 0xF000) {
-    case 0x0000:
-        if (emu->_opcode == 0x00E0) {
-            _chip_8_cls(emu);
-            draw = true;
-        } else if (emu->_opcode == 0x00EE) {
-            _chip_8_ret(emu);
-        } else {
-            fprintf(stderr, "Unknown instruction: %x\n", emu->_opcode);
-            exit(1);
+    PROFILE_HEAT(emu, emu->_pc);
+    emu->_opcode = insn->opcode;
+
+    if (op == CHIP_8_OP_LD_K) {
+        if (!_chip_8_ld_k(emu, insn)) {
+            return false;
+        }
+        emu->_pc += 2;
+    } else {
+        _chip_8_execute(emu, insn);
+        if (emu->_fault != CHIP_8_FAULT_NONE) {
+            return false;
         }
-        break;
-    case 0x1000:
-        _chip_8_jp(emu);
-        break;
-    case 0x2000:
-        _chip_8_call(emu);
-        break;
-    case 0x3000: {
-        _chip_8_se_byte(emu);
-        break;
     }
-    case 0x4000: {
-        _chip_8_sne_byte(emu);
-        break;
+
+    _chip_8_update_timers(emu);
+
+    return op == CHIP_8_OP_CLS || op == CHIP_8_OP_DRW;
+}
+
+void chip_8_set_ips(chip_8 *emu, uint32_t ips) {
+    if (ips < TIMER_HZ) {
+        ips = TIMER_HZ;
     }
-    case 0x5000: {
-        _chip_8_se_reg(emu);
-        break;
+
+    emu->_ips = ips;
+    emu->_timer_phase %= ips;
+}
+
+void chip_8_set_quirks(chip_8 *emu, unsigned quirks) {
+    emu->_quirks = quirks;
+}
+
+void chip_8_clear_fault(chip_8 *emu, bool skip) {
+    if (skip && emu->_fault != CHIP_8_FAULT_NONE) {
+        emu->_pc += 2;
     }
-    case 0x6000: {
-        _chip_8_ld_byte(emu);
-        break;
+
+    emu->_fault = CHIP_8_FAULT_NONE;
+}
+
+const char *chip_8_fault_name(chip_8_fault fault) {
+    switch (fault) {
+    case CHIP_8_FAULT_NONE:
+        return "No fault";
+    case CHIP_8_FAULT_UNKNOWN_OPCODE:
+        return "Unknown instruction";
+    case CHIP_8_FAULT_STACK_OVERFLOW:
+        return "Stack overflow";
+    case CHIP_8_FAULT_STACK_UNDERFLOW:
+        return "Stack underflow";
     }
-    case 0x7000: {
-        _chip_8_add_byte(emu);
-        break;
+    return "Unknown fault";
+}
+
+void chip_8_seed(chip_8 *emu, uint64_t seed) {
+    // One splitmix64 step spreads similar seeds apart and maps 0, which
+    // xorshift would get stuck on, to a usable state.
+    uint64_t z = seed + 0x9E3779B97F4A7C15;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EB;
+    z ^= z >> 31;
+
+    emu->_rng = z != 0 ? z : 1;
+}
+
+void _chip_8_advance(chip_8 *emu, uint32_t cycles) {
+    uint64_t phase = emu->_timer_phase + (uint64_t)cycles * TIMER_HZ;
+    uint64_t ticks = phase / emu->_ips;
+
+    emu->_cycles += cycles;
+    emu->_timer_phase = phase % emu->_ips;
+
+    if (emu->_delay_timer > ticks) {
+        emu->_delay_timer -= ticks;
+    } else {
+        emu->_delay_timer = 0;
     }
-    case 0x8000: {
-        switch (emu->_opcode & 0x000F) {
-            case 0x0000: {
-                _chip_8_ld_reg(emu);
-                break;
-            }
-            case 0x0001: {
-                _chip_8_or_reg(emu);
-                break;
-            }
-            case 0x0002: {
-                _chip_8_and_reg(emu);
-                break;
-            }
-            case 0x0003: {
-                _chip_8_xor_reg(emu);
-                break;
-            }
-            case 0x0004: {
-                _chip_8_add_reg(emu);
-                break;
-            }
-            case 0x0005: {
-                _chip_8_sub_reg(emu);
-                break;
-            }
-            case 0x0006: {
-                _chip_8_shr(emu);
-                break;
-            }
-            case 0x0007: {
-                _chip_8_subn_reg(emu);
-                break;
-            }
-            case 0x000E: {
-                _chip_8_shl(emu);
-                break;
-            }
-            default: {
-                fprintf(stderr, "Unknown instruction: %x\n", emu->_opcode);
-                exit(1);
+
+    if (emu->_sound_timer > ticks) {
+        emu->_sound_timer -= ticks;
+    } else {
+        emu->_sound_timer = 0;
+    }
+}
+
+/**
+ * Checks whether an Fx18 instruction turns the sound on.
+ *
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
+ * @return True if the sound timer is off and the instruction sets it.
+ */
+static inline bool _chip_8_starts_sound(const chip_8 *emu,
+                                        const chip_8_insn *insn) {
+    return emu->_sound_timer == 0 && emu->_V[insn->x] != 0;
+}
+
+/**
+ * Checks whether a 1nnn that was just executed jumped back by at most
+ * IDLE_LOOP_LEN instructions.
+ *
+ * @param emu  The emulator structure.
+ * @param insn The 1nnn.
+ * @return True if the jump closes a loop short enough to be waiting.
+ */
+static inline bool _chip_8_short_loop(const chip_8 *emu,
+                                      const chip_8_insn *insn) {
+    uint16_t back = (uint16_t)(insn - emu->_code) - emu->_pc;
+    return back <= 2 * (IDLE_LOOP_LEN - 1);
+}
+
+/**
+ * Runs one iteration of the loop from _pc to the jump at jump on a copy of
+ * the registers.
+ *
+ * @param emu     The emulator structure, with _pc at the start of the loop.
+ * @param jump    The address of the short 1nnn that jumped back to _pc.
+ * @param V       The registers, updated to those after the iteration.
+ * @param delay   The delay timer during the iteration.
+ * @param reads   Set to the number of times the iteration read the timer.
+ * @param read_at Set to the cycle of the iteration, from 0, of the last read.
+ * @param path    Set to the addresses of the instructions of the iteration,
+ *                up to IDLE_LOOP_LEN, or NULL.
+ * @return The cycles of the iteration if it reaches the jump again while
+ *         only comparing registers, reading keys or the delay timer and
+ *         loading registers, 0 otherwise.
+ */
+static uint32_t _chip_8_idle_iteration(const chip_8 *emu, uint16_t jump,
+                                       uint8_t *V, uint8_t delay,
+                                       uint32_t *reads, uint32_t *read_at,
+                                       uint16_t *path) {
+    uint16_t pc = emu->_pc;
+
+    *reads = 0;
+    *read_at = 0;
+
+    // Nothing in the loop jumps back, so an iteration is at most one pass.
+    for (uint32_t cycles = 0; cycles < IDLE_LOOP_LEN; cycles++) {
+        if (path != NULL) {
+            path[cycles] = pc;
+        }
+
+        if (pc == jump) {
+            return cycles + 1;
+        }
+
+        const chip_8_insn *insn = &emu->_code[pc];
+        bool skip = false;
+
+        switch (insn->op) {
+        case CHIP_8_OP_SE_BYTE:
+            skip = V[insn->x] == insn->kk;
+            break;
+        case CHIP_8_OP_SNE_BYTE:
+            skip = V[insn->x] != insn->kk;
+            break;
+        case CHIP_8_OP_SE_REG:
+            skip = V[insn->x] == V[insn->y];
+            break;
+        case CHIP_8_OP_SNE_REG:
+            skip = V[insn->x] != V[insn->y];
+            break;
+        case CHIP_8_OP_LD_BYTE:
+            V[insn->x] = insn->kk;
+            break;
+        case CHIP_8_OP_LD_REG:
+            V[insn->x] = V[insn->y];
+            break;
+        case CHIP_8_OP_SKP:
+            skip = emu->_keymap[V[insn->x] & KEY_MASK] != 0;
+            break;
+        case CHIP_8_OP_SKNP:
+            skip = emu->_keymap[V[insn->x] & KEY_MASK] == 0;
+            break;
+        case CHIP_8_OP_LD_DT:
+            V[insn->x] = delay;
+            (*reads)++;
+            *read_at = cycles;
+            break;
+        default:
+            return 0;
+        }
+
+        pc += skip ? 4 : 2;
+        if (pc > jump) {
+            return 0;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Follows a waiting loop that reads the delay timer once per iteration down
+ * the values the timer will take, for as long as each keeps the loop going.
+ *
+ * The timer ticks at most once per iteration, so every iteration starts from
+ * the registers the previous value or its own left. Each value is checked by
+ * running an iteration from the registers of the value before and another
+ * from the result, which both have to take the same path length and read the
+ * timer at the same cycle.
+ *
+ * @param emu     The emulator structure, at the start of the loop.
+ * @param jump    The address of the short 1nnn that jumped back to _pc.
+ * @param period  The cycles of an iteration.
+ * @param read_at The cycle of the iteration that reads the timer.
+ * @param max     The most iterations to skip.
+ * @param V       The registers, which an iteration leaves as they are,
+ *                updated to those after the iterations skipped.
+ * @return The number of iterations that can be skipped.
+ */
+static uint32_t _chip_8_idle_countdown(const chip_8 *emu, uint16_t jump,
+                                       uint32_t period, uint32_t read_at,
+                                       uint32_t max, uint8_t *V) {
+    uint8_t delay = emu->_delay_timer;
+    uint64_t phase = emu->_timer_phase;
+    uint64_t ips = emu->_ips;
+
+    // The ticks before the last iteration reads the timer.
+    uint64_t ticks =
+        (phase + TIMER_HZ * ((uint64_t)(max - 1) * period + read_at)) / ips;
+    int lowest = ticks < delay ? delay - (int)ticks : 0;
+
+    for (int value = delay - 1; value >= lowest; value--) {
+        uint8_t next[REGISTERS], again[REGISTERS];
+        uint32_t reads, at, reads_again, at_again;
+
+        memcpy(next, V, sizeof(next));
+        uint32_t cycles =
+            _chip_8_idle_iteration(emu, jump, next, value, &reads, &at, NULL);
+
+        memcpy(again, next, sizeof(again));
+        uint32_t cycles_again = _chip_8_idle_iteration(
+            emu, jump, again, value, &reads_again, &at_again, NULL);
+
+        if (cycles != period || reads != 1 || at != read_at ||
+            cycles_again != period || reads_again != 1 ||
+            at_again != read_at || memcmp(next, again, sizeof(next)) != 0) {
+            // Only the iterations that read a value above this one.
+            uint64_t until = (uint64_t)(delay - value) * ips;
+            uint64_t before = phase + TIMER_HZ * (uint64_t)read_at;
+            if (until <= before) {
+                return 0;
             }
+            return (until - before + TIMER_HZ * period - 1) /
+                   (TIMER_HZ * period);
         }
-        break;
+
+        memcpy(V, next, REGISTERS);
     }
-    case 0x9000: {
-        _chip_8_sne_reg(emu);
-        break;
+
+    return max;
+}
+
+/**
+ * Fast-forwards through a waiting loop after the 1nnn closing it.
+ *
+ * An iteration that leaves the registers as they were repeats until a key
+ * or the delay timer changes. Whole iterations are skipped by advancing the
+ * clock and the timers, following the delay timer down while it keeps the
+ * loop going if the loop reads it.
+ *
+ * @param emu    The emulator structure, after the timers of the jump.
+ * @param insn   The short 1nnn that was executed.
+ * @param budget The cycles left in the batch.
+ * @param keyed  Set if only a key press can leave the loop.
+ * @return The cycles skipped.
+ */
+static uint32_t _chip_8_skip_idle(chip_8 *emu, const chip_8_insn *insn,
+                                  uint32_t budget, bool *keyed) {
+    uint16_t jump = insn - emu->_code;
+    uint8_t V[REGISTERS];
+    uint16_t path[IDLE_LOOP_LEN];
+    uint32_t reads, read_at;
+
+    memcpy(V, emu->_V, sizeof(V));
+    uint32_t period = _chip_8_idle_iteration(emu, jump, V, emu->_delay_timer,
+                                             &reads, &read_at, path);
+
+    if (period == 0 || memcmp(V, emu->_V, sizeof(V)) != 0) {
+        return 0;
     }
-    case 0xA000: {
-        _chip_8_ld_addr(emu);
-        break;
+
+    uint32_t iterations = budget / period;
+
+    if (reads == 0 || emu->_delay_timer == 0) {
+        *keyed = true;
+    } else if (iterations == 0) {
+        return 0;
+    } else if (reads == 1 && emu->_ips >= TIMER_HZ * period) {
+        iterations = _chip_8_idle_countdown(emu, jump, period, read_at,
+                                            iterations, V);
+    } else {
+        // Reads after the cycle that ticks would see the next value.
+        uint32_t tick = (emu->_ips - emu->_timer_phase + TIMER_HZ - 1) /
+                        TIMER_HZ;
+        if (tick / period < iterations) {
+            iterations = tick / period;
+        }
     }
-    case 0xB000: {
-        _chip_8_jp_rel(emu);
-        break;
+
+    if (iterations == 0) {
+        return 0;
     }
-    case 0xC000: {
-        _chip_8_rnd(emu);
-        break;
+
+    memcpy(emu->_V, V, sizeof(V));
+    _chip_8_advance(emu, iterations * period);
+
+#ifdef CHIP_8_PROFILE
+    // The iterations skipped while following the timer down take as many
+    // cycles as the first; they are all counted along its path.
+    emu->_profile.skipped += iterations * period;
+    for (uint32_t i = 0; i < period; i++) {
+        emu->_profile.heat[path[i]] += iterations;
     }
-    case 0xD000: {
-        _chip_8_drw(emu);
-        draw = true;
-        break;
+#endif
+
+    return iterations * period;
+}
+
+#if defined(__GNUC__)
+// Direct threading: every handler ends in its own copy of the dispatch, so
+// the indirect branch after each instruction class is predicted separately.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#ifdef __clang__
+#pragma clang diagnostic ignored "-Wgnu-label-as-value"
+#endif
+
+chip_8_result chip_8_run_until(chip_8 *emu, uint32_t max_cycles,
+                               unsigned stop) {
+    static const void *labels[CHIP_8_OP_COUNT] = {
+        [CHIP_8_OP_CLS] = &&op_cls,
+        [CHIP_8_OP_RET] = &&op_ret,
+        [CHIP_8_OP_JP] = &&op_jp,
+        [CHIP_8_OP_CALL] = &&op_call,
+        [CHIP_8_OP_SE_BYTE] = &&op_se_byte,
+        [CHIP_8_OP_SNE_BYTE] = &&op_sne_byte,
+        [CHIP_8_OP_SE_REG] = &&op_se_reg,
+        [CHIP_8_OP_LD_BYTE] = &&op_ld_byte,
+        [CHIP_8_OP_ADD_BYTE] = &&op_add_byte,
+        [CHIP_8_OP_LD_REG] = &&op_ld_reg,
+        [CHIP_8_OP_OR_REG] = &&op_or_reg,
+        [CHIP_8_OP_AND_REG] = &&op_and_reg,
+        [CHIP_8_OP_XOR_REG] = &&op_xor_reg,
+        [CHIP_8_OP_ADD_REG] = &&op_add_reg,
+        [CHIP_8_OP_SUB_REG] = &&op_sub_reg,
+        [CHIP_8_OP_SHR] = &&op_shr,
+        [CHIP_8_OP_SUBN_REG] = &&op_subn_reg,
+        [CHIP_8_OP_SHL] = &&op_shl,
+        [CHIP_8_OP_SNE_REG] = &&op_sne_reg,
+        [CHIP_8_OP_LD_ADDR] = &&op_ld_addr,
+        [CHIP_8_OP_JP_REL] = &&op_jp_rel,
+        [CHIP_8_OP_RND] = &&op_rnd,
+        [CHIP_8_OP_DRW] = &&op_drw,
+        [CHIP_8_OP_SKP] = &&op_skp,
+        [CHIP_8_OP_SKNP] = &&op_sknp,
+        [CHIP_8_OP_LD_DT] = &&op_ld_dt,
+        [CHIP_8_OP_LD_K] = &&op_ld_k,
+        [CHIP_8_OP_LD_DT_REG] = &&op_ld_dt_reg,
+        [CHIP_8_OP_LD_ST_REG] = &&op_ld_st_reg,
+        [CHIP_8_OP_ADD_I_REG] = &&op_add_i_reg,
+        [CHIP_8_OP_LD_F_REG] = &&op_ld_f_reg,
+        [CHIP_8_OP_LD_B_REG] = &&op_ld_b_reg,
+        [CHIP_8_OP_LD_I_REG] = &&op_ld_i_reg,
+        [CHIP_8_OP_LD_REG_I] = &&op_ld_reg_i,
+        [CHIP_8_OP_UNKNOWN] = &&op_unknown,
+    };
+
+    const chip_8_insn *insn;
+    chip_8_result result = {0, 0, CHIP_8_EXIT_BUDGET};
+    bool keyed = false;
+
+#define NEXT()                                                                 \
+    do {                                                                       \
+        _chip_8_update_timers(emu);                                            \
+        DISPATCH();                                                            \
+    } while (0)
+
+#define DISPATCH()                                                             \
+    do {                                                                       \
+        if (result.cycles == max_cycles) {                                     \
+            goto done;                                                         \
+        }                                                                      \
+        insn = _chip_8_fetch(emu);                                             \
+        PROFILE_HEAT(emu, emu->_pc);                                           \
+        emu->_opcode = insn->opcode;                                           \
+        result.cycles++;                                                       \
+        goto *labels[insn->op];                                                \
+    } while (0)
+
+    if (emu->_fault != CHIP_8_FAULT_NONE) {
+        result.reason = CHIP_8_EXIT_ERROR;
+        return result;
     }
-    case 0xE000: {
-        if ((emu->_opcode & 0x00FF) == 0x009E) {
-            _chip_8_skp(emu);
-        } else if ((emu->_opcode & 0x00FF) == 0x00A1) {
-            _chip_8_sknp(emu);
-        } else {
-            fprintf(stderr, "Unknown instruction: %x\n", emu->_opcode);
-            exit(1);
-        }
-        break;
+
+    if (max_cycles == 0) {
+        return result;
     }
-    case 0xF000: {
-        switch (emu->_opcode & 0x00FF) {
-            case 0x0007: {
-                _chip_8_ld_dt(emu);
-                break;
-            }
-            case 0x000A: {
-                bool pressed = _chip_8_ld_k(emu);
 
-                if (!pressed) {
-                    return draw;
-                }
+#ifdef CHIP_8_PROFILE
+    uint64_t profile_start = _chip_8_profile_clock();
+#endif
 
-                emu->_pc += 2;
-                break;
-            }
-            case 0x0015: {
-                _chip_8_ld_dt_reg(emu);
-                break;
-            }
-            case 0x0018: {
-                _chip_8_ld_st_reg(emu);
-                break;
-            }
-            case 0x001E: {
-                _chip_8_add_i_reg(emu);
-                break;
-            }
-            case 0x0029: {
-                _chip_8_ld_f_reg(emu);
+    insn = _chip_8_fetch(emu);
+    PROFILE_HEAT(emu, emu->_pc);
+    emu->_opcode = insn->opcode;
+    result.cycles++;
+    goto *labels[insn->op];
+
+op_cls:
+    PROFILE(emu, CHIP_8_OP_CLS, _chip_8_cls(emu, insn));
+    result.draws++;
+    if (stop & CHIP_8_EXIT_DRAW) {
+        _chip_8_update_timers(emu);
+        result.reason = CHIP_8_EXIT_DRAW;
+        goto done;
+    }
+    NEXT();
+op_ret:
+    PROFILE(emu, CHIP_8_OP_RET, _chip_8_ret(emu, insn));
+    if (emu->_fault != CHIP_8_FAULT_NONE) {
+        goto fault;
+    }
+    NEXT();
+op_jp:
+    PROFILE(emu, CHIP_8_OP_JP, _chip_8_jp(emu, insn));
+    _chip_8_update_timers(emu);
+    if (result.cycles != max_cycles && _chip_8_short_loop(emu, insn)) {
+        result.cycles +=
+            _chip_8_skip_idle(emu, insn, max_cycles - result.cycles, &keyed);
+    }
+    DISPATCH();
+op_call:
+    PROFILE(emu, CHIP_8_OP_CALL, _chip_8_call(emu, insn));
+    if (emu->_fault != CHIP_8_FAULT_NONE) {
+        goto fault;
+    }
+    NEXT();
+op_se_byte:
+    PROFILE(emu, CHIP_8_OP_SE_BYTE, _chip_8_se_byte(emu, insn));
+    NEXT();
+op_sne_byte:
+    PROFILE(emu, CHIP_8_OP_SNE_BYTE, _chip_8_sne_byte(emu, insn));
+    NEXT();
+op_se_reg:
+    PROFILE(emu, CHIP_8_OP_SE_REG, _chip_8_se_reg(emu, insn));
+    NEXT();
+op_ld_byte:
+    PROFILE(emu, CHIP_8_OP_LD_BYTE, _chip_8_ld_byte(emu, insn));
+    NEXT();
+op_add_byte:
+    PROFILE(emu, CHIP_8_OP_ADD_BYTE, _chip_8_add_byte(emu, insn));
+    NEXT();
+op_ld_reg:
+    PROFILE(emu, CHIP_8_OP_LD_REG, _chip_8_ld_reg(emu, insn));
+    NEXT();
+op_or_reg:
+    PROFILE(emu, CHIP_8_OP_OR_REG, _chip_8_or_reg(emu, insn));
+    NEXT();
+op_and_reg:
+    PROFILE(emu, CHIP_8_OP_AND_REG, _chip_8_and_reg(emu, insn));
+    NEXT();
+op_xor_reg:
+    PROFILE(emu, CHIP_8_OP_XOR_REG, _chip_8_xor_reg(emu, insn));
+    NEXT();
+op_add_reg:
+    PROFILE(emu, CHIP_8_OP_ADD_REG, _chip_8_add_reg(emu, insn));
+    NEXT();
+op_sub_reg:
+    PROFILE(emu, CHIP_8_OP_SUB_REG, _chip_8_sub_reg(emu, insn));
+    NEXT();
+op_shr:
+    PROFILE(emu, CHIP_8_OP_SHR, _chip_8_shr(emu, insn));
+    NEXT();
+op_subn_reg:
+    PROFILE(emu, CHIP_8_OP_SUBN_REG, _chip_8_subn_reg(emu, insn));
+    NEXT();
+op_shl:
+    PROFILE(emu, CHIP_8_OP_SHL, _chip_8_shl(emu, insn));
+    NEXT();
+op_sne_reg:
+    PROFILE(emu, CHIP_8_OP_SNE_REG, _chip_8_sne_reg(emu, insn));
+    NEXT();
+op_ld_addr:
+    PROFILE(emu, CHIP_8_OP_LD_ADDR, _chip_8_ld_addr(emu, insn));
+    NEXT();
+op_jp_rel:
+    PROFILE(emu, CHIP_8_OP_JP_REL, _chip_8_jp_rel(emu, insn));
+    NEXT();
+op_rnd:
+    PROFILE(emu, CHIP_8_OP_RND, _chip_8_rnd(emu, insn));
+    NEXT();
+op_drw:
+    PROFILE(emu, CHIP_8_OP_DRW, _chip_8_drw(emu, insn));
+    result.draws++;
+    if (stop & CHIP_8_EXIT_DRAW) {
+        _chip_8_update_timers(emu);
+        result.reason = CHIP_8_EXIT_DRAW;
+        goto done;
+    }
+    NEXT();
+op_skp:
+    PROFILE(emu, CHIP_8_OP_SKP, _chip_8_skp(emu, insn));
+    NEXT();
+op_sknp:
+    PROFILE(emu, CHIP_8_OP_SKNP, _chip_8_sknp(emu, insn));
+    NEXT();
+op_ld_dt:
+    PROFILE(emu, CHIP_8_OP_LD_DT, _chip_8_ld_dt(emu, insn));
+    NEXT();
+op_ld_k:
+    if (!_chip_8_ld_k(emu, insn)) {
+        result.cycles--;
+        result.reason = CHIP_8_EXIT_KEY_WAIT;
+        goto done;
+    }
+    emu->_pc += 2;
+    NEXT();
+op_ld_dt_reg:
+    PROFILE(emu, CHIP_8_OP_LD_DT_REG, _chip_8_ld_dt_reg(emu, insn));
+    NEXT();
+op_ld_st_reg:
+    if ((stop & CHIP_8_EXIT_SOUND) && _chip_8_starts_sound(emu, insn)) {
+        PROFILE(emu, CHIP_8_OP_LD_ST_REG, _chip_8_ld_st_reg(emu, insn));
+        _chip_8_update_timers(emu);
+        result.reason = CHIP_8_EXIT_SOUND;
+        goto done;
+    }
+    PROFILE(emu, CHIP_8_OP_LD_ST_REG, _chip_8_ld_st_reg(emu, insn));
+    NEXT();
+op_add_i_reg:
+    PROFILE(emu, CHIP_8_OP_ADD_I_REG, _chip_8_add_i_reg(emu, insn));
+    NEXT();
+op_ld_f_reg:
+    PROFILE(emu, CHIP_8_OP_LD_F_REG, _chip_8_ld_f_reg(emu, insn));
+    NEXT();
+op_ld_b_reg:
+    PROFILE(emu, CHIP_8_OP_LD_B_REG, _chip_8_ld_b_reg(emu, insn));
+    NEXT();
+op_ld_i_reg:
+    PROFILE(emu, CHIP_8_OP_LD_I_REG, _chip_8_ld_i_reg(emu, insn));
+    NEXT();
+op_ld_reg_i:
+    PROFILE(emu, CHIP_8_OP_LD_REG_I, _chip_8_ld_reg_i(emu, insn));
+    NEXT();
+op_unknown:
+    PROFILE(emu, CHIP_8_OP_UNKNOWN, _chip_8_unknown(emu, insn));
+    goto fault;
+
+#undef DISPATCH
+#undef NEXT
+
+fault:
+    // The faulting instruction is neither executed nor counted.
+    result.cycles--;
+    result.reason = CHIP_8_EXIT_ERROR;
+done:
+    // Without a key press the batch cannot have left the loop.
+    if (keyed && result.reason == CHIP_8_EXIT_BUDGET &&
+        (stop & CHIP_8_EXIT_IDLE)) {
+        result.reason = CHIP_8_EXIT_IDLE;
+    }
+#ifdef CHIP_8_PROFILE
+    emu->_profile.run_ticks += _chip_8_profile_clock() - profile_start;
+    emu->_profile.run_cycles += result.cycles;
+#endif
+    return result;
+}
+
+#pragma GCC diagnostic pop
+#else
+chip_8_result chip_8_run_until(chip_8 *emu, uint32_t max_cycles,
+                               unsigned stop) {
+    chip_8_result result = {0, 0, CHIP_8_EXIT_BUDGET};
+    bool keyed = false;
+
+    if (emu->_fault != CHIP_8_FAULT_NONE) {
+        result.reason = CHIP_8_EXIT_ERROR;
+        return result;
+    }
+
+#ifdef CHIP_8_PROFILE
+    uint64_t profile_start = _chip_8_profile_clock();
+#endif
+
+    while (result.cycles < max_cycles) {
+        const chip_8_insn *insn = _chip_8_fetch(emu);
+        chip_8_op op = insn->op;
+        bool sound = op == CHIP_8_OP_LD_ST_REG &&
+                     _chip_8_starts_sound(emu, insn);
+
+        PROFILE_HEAT(emu, emu->_pc);
+        emu->_opcode = insn->opcode;
+
+        if (op == CHIP_8_OP_LD_K) {
+            if (!_chip_8_ld_k(emu, insn)) {
+                result.reason = CHIP_8_EXIT_KEY_WAIT;
                 break;
             }
-            case 0x0033: {
-                _chip_8_ld_b_reg(emu);
+            emu->_pc += 2;
+        } else {
+            _chip_8_execute(emu, insn);
+            if (emu->_fault != CHIP_8_FAULT_NONE) {
+                result.reason = CHIP_8_EXIT_ERROR;
                 break;
             }
-            case 0x0055: {
-                _chip_8_ld_i_reg(emu);
+        }
+
+        _chip_8_update_timers(emu);
+        result.cycles++;
+
+        if (op == CHIP_8_OP_JP && result.cycles < max_cycles &&
+            _chip_8_short_loop(emu, insn)) {
+            result.cycles += _chip_8_skip_idle(
+                emu, insn, max_cycles - result.cycles, &keyed);
+        }
+
+        if (op == CHIP_8_OP_CLS || op == CHIP_8_OP_DRW) {
+            result.draws++;
+            if (stop & CHIP_8_EXIT_DRAW) {
+                result.reason = CHIP_8_EXIT_DRAW;
                 break;
             }
-            case 0x0065: {
-                _chip_8_ld_reg_i(emu);
-                break;
+        }
+        if (sound && (stop & CHIP_8_EXIT_SOUND)) {
+            result.reason = CHIP_8_EXIT_SOUND;
+            break;
+        }
+    }
+
+    // Without a key press the batch cannot have left the loop.
+    if (keyed && result.reason == CHIP_8_EXIT_BUDGET &&
+        (stop & CHIP_8_EXIT_IDLE)) {
+        result.reason = CHIP_8_EXIT_IDLE;
+    }
+
+#ifdef CHIP_8_PROFILE
+    emu->_profile.run_ticks += _chip_8_profile_clock() - profile_start;
+    emu->_profile.run_cycles += result.cycles;
+#endif
+
+    return result;
+}
+#endif
+
+chip_8_result chip_8_step_n(chip_8 *emu, uint32_t cycles) {
+    return chip_8_run_until(emu, cycles,
+                            CHIP_8_EXIT_KEY_WAIT | CHIP_8_EXIT_ERROR);
+}
+
+uint32_t chip_8_run(chip_8 *emu, uint32_t max_cycles, bool *draw) {
+    chip_8_result result =
+        chip_8_run_until(emu, max_cycles, CHIP_8_EXIT_DRAW);
+
+    *draw = result.reason == CHIP_8_EXIT_DRAW;
+
+    return result.cycles;
+}
+
+static bool _chip_8_ends_block(uint8_t op) {
+    switch (op) {
+    case CHIP_8_OP_RET:
+    case CHIP_8_OP_JP:
+    case CHIP_8_OP_CALL:
+    case CHIP_8_OP_SE_BYTE:
+    case CHIP_8_OP_SNE_BYTE:
+    case CHIP_8_OP_SE_REG:
+    case CHIP_8_OP_SNE_REG:
+    case CHIP_8_OP_JP_REL:
+    case CHIP_8_OP_SKP:
+    case CHIP_8_OP_SKNP:
+    case CHIP_8_OP_LD_K:
+    case CHIP_8_OP_UNKNOWN:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static chip_8_block *_chip_8_translate_block(chip_8 *emu, uint16_t start) {
+    if (emu->_block_count == BLOCK_CACHE_SIZE) {
+        _chip_8_flush_blocks(emu);
+    }
+
+    chip_8_block *block = &emu->_blocks[emu->_block_count++];
+    block->start = start;
+    block->len = 0;
+    block->uop_count = 0;
+    block->executions = 0;
+
+    for (size_t addr = start; addr < MEMORY_SIZE && block->len < BLOCK_MAX_LEN;
+         addr += 2) {
+        const chip_8_insn *insn = &emu->_code[addr];
+        chip_8_insn *prev = NULL;
+        if (block->uop_count > 0) {
+            prev = &block->uops[block->uop_count - 1];
+        }
+
+        if (prev && prev->op == CHIP_8_OP_LD_BYTE &&
+            insn->op == CHIP_8_OP_LD_ADDR) {
+            prev->op = CHIP_8_UOP_LD_BYTE_ADDR;
+            prev->nnn = insn->nnn;
+        } else if (prev && prev->op == CHIP_8_OP_LD_ADDR &&
+                   insn->op == CHIP_8_OP_DRW) {
+            uint16_t nnn = prev->nnn;
+            *prev = *insn;
+            prev->op = CHIP_8_UOP_LD_ADDR_DRW;
+            prev->nnn = nnn;
+        } else {
+            block->uops[block->uop_count++] = *insn;
+        }
+
+        block->len++;
+        emu->_block_cover[addr] = 1;
+        emu->_block_cover[(addr + 1) & ADDR_MASK] = 1;
+
+        if (_chip_8_ends_block(insn->op)) {
+            break;
+        }
+    }
+
+    emu->_block_map[start] = emu->_block_count;
+    return block;
+}
+
+uint32_t chip_8_emulate_block(chip_8 *emu) {
+    if (emu->_pc >= MEMORY_SIZE || emu->_fault != CHIP_8_FAULT_NONE) {
+        return chip_8_emulate_cycle(emu);
+    }
+
+    uint16_t index = emu->_block_map[emu->_pc];
+    chip_8_block *block = index ? &emu->_blocks[index - 1]
+                                : _chip_8_translate_block(emu, emu->_pc);
+
+    uint32_t flushes = emu->_block_flushes;
+    uint32_t draws = 0;
+
+    block->executions++;
+
+    for (size_t i = 0; i < block->uop_count; i++) {
+        const chip_8_insn *uop = &block->uops[i];
+
+        PROFILE_HEAT(emu, emu->_pc);
+        emu->_opcode = uop->opcode;
+
+        switch (uop->op) {
+        case CHIP_8_UOP_LD_BYTE_ADDR:
+            PROFILE_HEAT(emu, emu->_pc + 2);
+            emu->_V[uop->x] = uop->kk;
+            emu->_I = uop->nnn;
+            emu->_pc += 4;
+            _chip_8_update_timers(emu);
+            break;
+        case CHIP_8_UOP_LD_ADDR_DRW:
+            PROFILE_HEAT(emu, emu->_pc + 2);
+            emu->_I = uop->nnn;
+            emu->_pc += 2;
+            _chip_8_update_timers(emu);
+            PROFILE(emu, CHIP_8_OP_DRW, _chip_8_drw(emu, uop));
+            draws++;
+            break;
+        case CHIP_8_OP_LD_K:
+            if (!_chip_8_ld_k(emu, uop)) {
+                return draws;
             }
-            default: {
-                fprintf(stderr, "Unknown instruction: %x\n", emu->_opcode);
-                exit(1);
+            emu->_pc += 2;
+            break;
+        case CHIP_8_OP_CLS:
+        case CHIP_8_OP_DRW:
+            _chip_8_execute(emu, uop);
+            draws++;
+            break;
+        case CHIP_8_OP_RET:
+        case CHIP_8_OP_CALL:
+        case CHIP_8_OP_UNKNOWN:
+            _chip_8_execute(emu, uop);
+            if (emu->_fault != CHIP_8_FAULT_NONE) {
+                return draws;
             }
+            break;
+        default:
+            _chip_8_execute(emu, uop);
+            break;
+        }
+
+        _chip_8_update_timers(emu);
+
+        // The block wrote into translated code and is no longer valid.
+        if (emu->_block_flushes != flushes) {
+            break;
         }
-        break;
-    }
-    default: {
-        fprintf(stderr, "Unknown instruction: %x\n", emu->_opcode);
-        exit(1);
     }
+
+    return draws;
+}
+
+static int _chip_8_compare_blocks(const void *a, const void *b) {
+    const chip_8_block *x = *(const chip_8_block *const *)a;
+    const chip_8_block *y = *(const chip_8_block *const *)b;
+    return (x->executions < y->executions) - (x->executions > y->executions);
+}
+
+void chip_8_dump_blocks(const chip_8 *emu, FILE *out) {
+    static const char *fusions[CHIP_8_UOP_END - CHIP_8_OP_COUNT] = {
+        [CHIP_8_UOP_LD_BYTE_ADDR - CHIP_8_OP_COUNT] = "6xkk+Annn",
+        [CHIP_8_UOP_LD_ADDR_DRW - CHIP_8_OP_COUNT] = "Annn+Dxyn",
+    };
+
+    const chip_8_block *sorted[BLOCK_CACHE_SIZE];
+    unsigned long long fused[CHIP_8_UOP_END - CHIP_8_OP_COUNT] = {0};
+
+    for (size_t i = 0; i < emu->_block_count; i++) {
+        sorted[i] = &emu->_blocks[i];
     }
+    qsort(sorted, emu->_block_count, sizeof(sorted[0]), _chip_8_compare_blocks);
 
-    if (emu->_delay_timer) {
-        emu->_delay_timer--;
+    fprintf(out, "start  len  uops  fused  executions\n");
+    for (size_t i = 0; i < emu->_block_count; i++) {
+        const chip_8_block *block = sorted[i];
+        int fused_count = 0;
+
+        for (size_t j = 0; j < block->uop_count; j++) {
+            if (block->uops[j].op >= CHIP_8_OP_COUNT) {
+                fused[block->uops[j].op - CHIP_8_OP_COUNT] += block->executions;
+                fused_count++;
+            }
+        }
+
+        fprintf(out,
+            "0x%03x  %3d  %4d  %5d  %10u\n",
+            block->start,
+            block->len,
+            block->uop_count,
+            fused_count,
+            block->executions);
     }
 
-    if (emu->_sound_timer > 0) {
-        emu->_sound_timer--;
+    for (size_t i = 0; i < CHIP_8_UOP_END - CHIP_8_OP_COUNT; i++) {
+        fprintf(out, "%s executed %llu times\n", fusions[i], fused[i]);
     }
+}
 
-    return draw;
+chip_8_op chip_8_decode(uint16_t opcode) {
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        if (opcode == 0x00E0) {
+            return CHIP_8_OP_CLS;
+        } else if (opcode == 0x00EE) {
+            return CHIP_8_OP_RET;
+        }
+        return CHIP_8_OP_UNKNOWN;
+    case 0x1000:
+        return CHIP_8_OP_JP;
+    case 0x2000:
+        return CHIP_8_OP_CALL;
+    case 0x3000:
+        return CHIP_8_OP_SE_BYTE;
+    case 0x4000:
+        return CHIP_8_OP_SNE_BYTE;
+    case 0x5000:
+        return CHIP_8_OP_SE_REG;
+    case 0x6000:
+        return CHIP_8_OP_LD_BYTE;
+    case 0x7000:
+        return CHIP_8_OP_ADD_BYTE;
+    case 0x8000:
+        switch (opcode & 0x000F) {
+            case 0x0000:
+                return CHIP_8_OP_LD_REG;
+            case 0x0001:
+                return CHIP_8_OP_OR_REG;
+            case 0x0002:
+                return CHIP_8_OP_AND_REG;
+            case 0x0003:
+                return CHIP_8_OP_XOR_REG;
+            case 0x0004:
+                return CHIP_8_OP_ADD_REG;
+            case 0x0005:
+                return CHIP_8_OP_SUB_REG;
+            case 0x0006:
+                return CHIP_8_OP_SHR;
+            case 0x0007:
+                return CHIP_8_OP_SUBN_REG;
+            case 0x000E:
+                return CHIP_8_OP_SHL;
+        }
+        return CHIP_8_OP_UNKNOWN;
+    case 0x9000:
+        return CHIP_8_OP_SNE_REG;
+    case 0xA000:
+        return CHIP_8_OP_LD_ADDR;
+    case 0xB000:
+        return CHIP_8_OP_JP_REL;
+    case 0xC000:
+        return CHIP_8_OP_RND;
+    case 0xD000:
+        return CHIP_8_OP_DRW;
+    case 0xE000:
+        if ((opcode & 0x00FF) == 0x009E) {
+            return CHIP_8_OP_SKP;
+        } else if ((opcode & 0x00FF) == 0x00A1) {
+            return CHIP_8_OP_SKNP;
+        }
+        return CHIP_8_OP_UNKNOWN;
+    case 0xF000:
+        switch (opcode & 0x00FF) {
+            case 0x0007:
+                return CHIP_8_OP_LD_DT;
+            case 0x000A:
+                return CHIP_8_OP_LD_K;
+            case 0x0015:
+                return CHIP_8_OP_LD_DT_REG;
+            case 0x0018:
+                return CHIP_8_OP_LD_ST_REG;
+            case 0x001E:
+                return CHIP_8_OP_ADD_I_REG;
+            case 0x0029:
+                return CHIP_8_OP_LD_F_REG;
+            case 0x0033:
+                return CHIP_8_OP_LD_B_REG;
+            case 0x0055:
+                return CHIP_8_OP_LD_I_REG;
+            case 0x0065:
+                return CHIP_8_OP_LD_REG_I;
+        }
+        return CHIP_8_OP_UNKNOWN;
+    }
+    return CHIP_8_OP_UNKNOWN;
 }
 
-void _chip_8_cls(chip_8 *emu) {
-    memset(emu->_framebuffer, 0, FB_SIZE);
+void _chip_8_cls(chip_8 *emu, const chip_8_insn *insn) {
+    memset(emu->_framebuffer, 0, sizeof(emu->_framebuffer));
+    emu->_dirty_rows = UINT32_MAX;
     emu->_pc += 2;
 }
 
-void _chip_8_ret(chip_8 *emu) {
+void _chip_8_ret(chip_8 *emu, const chip_8_insn *insn) {
+    if (emu->_sp == 0) {
+        emu->_fault = CHIP_8_FAULT_STACK_UNDERFLOW;
+        return;
+    }
+
     emu->_sp--;
     emu->_pc = emu->_stack[emu->_sp];
     emu->_pc += 2;
 }
 
-void _chip_8_jp(chip_8 *emu) { emu->_pc = emu->_opcode & 0x0FFF; }
+void _chip_8_jp(chip_8 *emu, const chip_8_insn *insn) { emu->_pc = insn->nnn; }
+
+void _chip_8_call(chip_8 *emu, const chip_8_insn *insn) {
+    if (emu->_sp >= STACK_SIZE) {
+        emu->_fault = CHIP_8_FAULT_STACK_OVERFLOW;
+        return;
+    }
 
-void _chip_8_call(chip_8 *emu) {
     emu->_stack[emu->_sp] = emu->_pc;
     emu->_sp++;
-    emu->_pc = emu->_opcode & 0x0FFF;
+    emu->_pc = insn->nnn;
 }
 
-void _chip_8_se_byte(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t kk = (emu->_opcode & 0x00FF);
+void _chip_8_se_byte(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t kk = insn->kk;
     if (emu->_V[x] == kk) {
         emu->_pc += 4;
     } else {
@@ -295,9 +1359,9 @@ void _chip_8_se_byte(chip_8 *emu) {
     }
 }
 
-void _chip_8_sne_byte(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t kk = (emu->_opcode & 0x00FF);
+void _chip_8_sne_byte(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t kk = insn->kk;
     if (emu->_V[x] != kk) {
         emu->_pc += 4;
     } else {
@@ -305,9 +1369,9 @@ void _chip_8_sne_byte(chip_8 *emu) {
     }
 }
 
-void _chip_8_se_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_se_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     if (emu->_V[x] == emu->_V[y]) {
         emu->_pc += 4;
     } else {
@@ -315,51 +1379,51 @@ void _chip_8_se_reg(chip_8 *emu) {
     }
 }
 
-void _chip_8_ld_byte(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t kk = (emu->_opcode & 0x00FF);
+void _chip_8_ld_byte(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t kk = insn->kk;
     emu->_V[x] = kk;
     emu->_pc += 2;
 }
 
-void _chip_8_add_byte(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t kk = (emu->_opcode & 0x00FF);
+void _chip_8_add_byte(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t kk = insn->kk;
     emu->_V[x] = emu->_V[x] + kk;
     emu->_pc += 2;
 }
 
-void _chip_8_ld_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_ld_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     emu->_V[x] = emu->_V[y];
     emu->_pc += 2;
 }
 
-void _chip_8_or_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_or_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     emu->_V[x] = emu->_V[x] | emu->_V[y];
     emu->_pc += 2;
 }
 
-void _chip_8_and_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_and_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     emu->_V[x] = emu->_V[x] & emu->_V[y];
     emu->_pc += 2;
 }
 
-void _chip_8_xor_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_xor_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     emu->_V[x] = emu->_V[x] ^ emu->_V[y];
     emu->_pc += 2;
 }
 
-void _chip_8_add_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_add_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     if (emu->_V[x] + emu->_V[y] > 255) {
         emu->_V[0xF] = 1;
     } else {
@@ -369,9 +1433,9 @@ void _chip_8_add_reg(chip_8 *emu) {
     emu->_pc += 2;
 }
 
-void _chip_8_sub_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_sub_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     if (emu->_V[x] < emu->_V[y]) {
         emu->_V[0xF] = 1;
     } else {
@@ -381,16 +1445,16 @@ void _chip_8_sub_reg(chip_8 *emu) {
     emu->_pc += 2;
 }
 
-void _chip_8_shr(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_shr(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     emu->_V[0xF] = emu->_V[x] & 0x1;
     emu->_V[x] = emu->_V[x] >> 1;
     emu->_pc += 2;
 }
 
-void _chip_8_subn_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_subn_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     if (emu->_V[x] > emu->_V[y]) {
         emu->_V[0xF] = 0;
     } else {
@@ -400,16 +1464,16 @@ void _chip_8_subn_reg(chip_8 *emu) {
     emu->_pc += 2;
 }
 
-void _chip_8_shl(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_shl(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     emu->_V[0xF] = emu->_V[x] >> 7;
     emu->_V[x] = emu->_V[x] << 1;
     emu->_pc += 2;
 }
 
-void _chip_8_sne_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
+void _chip_8_sne_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t y = insn->y;
     if (emu->_V[x] != emu->_V[y]) {
         emu->_pc += 4;
     } else {
@@ -417,48 +1481,64 @@ void _chip_8_sne_reg(chip_8 *emu) {
     }
 }
 
-void _chip_8_ld_addr(chip_8 *emu) {
-    emu->_I = emu->_opcode & 0x0FFF;
+void _chip_8_ld_addr(chip_8 *emu, const chip_8_insn *insn) {
+    emu->_I = insn->nnn;
     emu->_pc += 2;
 }
 
-void _chip_8_jp_rel(chip_8 *emu) {
-    emu->_pc = emu->_V[0x0] + (emu->_opcode & 0x0FFF);
+void _chip_8_jp_rel(chip_8 *emu, const chip_8_insn *insn) {
+    emu->_pc = emu->_V[0x0] + insn->nnn;
 }
 
-void _chip_8_rnd(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t kk = emu->_opcode & 0x00FF;
-    emu->_V[x] = (rand() % (255 + 1)) & kk;
+void _chip_8_rnd(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t kk = insn->kk;
+
+    uint64_t rng = emu->_rng;
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    emu->_rng = rng;
+
+    // The high bits of the scrambled output are the strongest.
+    emu->_V[x] = (rng * 0x2545F4914F6CDD1D) >> 56 & kk;
     emu->_pc += 2;
 }
 
-void _chip_8_drw(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    uint16_t y = (emu->_opcode & 0x00F0) >> 4;
-    uint16_t n = (emu->_opcode & 0x000F);
-
-    uint16_t v_x = emu->_V[x];
-    uint16_t v_y = emu->_V[y];
-
-    emu->_V[0xF] = 0;
-    for (size_t row = 0; row < n; row++) {
-        uint16_t pixel = emu->_memory[emu->_I + row];
-        for (size_t col = 0; col < 8; col++) {
-            if ((pixel & (0x80 >> col)) != 0) {
-                size_t index = (v_x + col + ((v_y + row) * 64));
-                if (emu->_framebuffer[index] == 1) {
-                    emu->_V[0xF] = 1;
-                }
-                emu->_framebuffer[index] ^= 1;
-            }
-        }
+void _chip_8_drw(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t n = insn->n;
+
+    // The starting position always wraps onto the screen.
+    size_t shift = emu->_V[insn->x] & (FB_WIDTH - 1);
+    size_t top = emu->_V[insn->y] & (FB_HEIGHT - 1);
+
+    // Everything that depends on the mode is settled once per sprite: spill
+    // selects the pixels past the right edge, which come back on the left
+    // when wrapping, and rows past the bottom either come back at the top or
+    // are not drawn at all.
+    bool wrap = emu->_quirks & CHIP_8_QUIRK_WRAP;
+    uint64_t spill = wrap ? UINT64_MAX : 0;
+    size_t back = (FB_WIDTH - shift) & (FB_WIDTH - 1);
+    size_t rows = wrap || top + n <= FB_HEIGHT ? n : FB_HEIGHT - top;
+    uint64_t collision = 0;
+
+    for (size_t row = 0; row < rows; row++) {
+        uint64_t sprite =
+            (uint64_t)emu->_memory[(emu->_I + row) & ADDR_MASK] << 56;
+        uint64_t bits = (sprite >> shift) | ((sprite << back) & spill);
+        size_t word = (top + row) & (FB_HEIGHT - 1);
+
+        collision |= emu->_framebuffer[word] & bits;
+        emu->_framebuffer[word] ^= bits;
+        emu->_dirty_rows |= (uint32_t)(bits != 0) << word;
     }
+
+    emu->_V[0xF] = collision != 0;
     emu->_pc += 2;
 }
 
-void _chip_8_skp(chip_8 *emu) {
-    uint16_t key_index = emu->_V[(emu->_opcode & 0x0F00) >> 8];
+void _chip_8_skp(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t key_index = emu->_V[insn->x] & KEY_MASK;
     if (emu->_keymap[key_index] != 0) {
         emu->_pc += 4;
     } else {
@@ -466,8 +1546,8 @@ void _chip_8_skp(chip_8 *emu) {
     }
 }
 
-void _chip_8_sknp(chip_8 *emu) {
-    uint16_t key_index = emu->_V[(emu->_opcode & 0x0F00) >> 8];
+void _chip_8_sknp(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t key_index = emu->_V[insn->x] & KEY_MASK;
     if (emu->_keymap[key_index] == 0) {
         emu->_pc += 4;
     } else {
@@ -475,15 +1555,15 @@ void _chip_8_sknp(chip_8 *emu) {
     }
 }
 
-void _chip_8_ld_dt(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_ld_dt(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     emu->_V[x] = emu->_delay_timer;
     emu->_pc += 2;
 }
 
-bool _chip_8_ld_k(chip_8 *emu) {
+bool _chip_8_ld_k(chip_8 *emu, const chip_8_insn *insn) {
     bool pressed = false;
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+    uint16_t x = insn->x;
     for (size_t i = 0; i < KEYMAP_SIZE; i++) {
         if (emu->_keymap[i] != 0) {
             emu->_V[x] = i;
@@ -493,20 +1573,20 @@ bool _chip_8_ld_k(chip_8 *emu) {
     return pressed;
 }
 
-void _chip_8_ld_dt_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_ld_dt_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     emu->_delay_timer = emu->_V[x];
     emu->_pc += 2;
 }
 
-void _chip_8_ld_st_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_ld_st_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     emu->_sound_timer = emu->_V[x];
     emu->_pc += 2;
 }
 
-void _chip_8_add_i_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_add_i_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     if (emu->_I + emu->_V[x] > 0xFFF) {
         emu->_V[0xF] = 1;
     } else {
@@ -516,34 +1596,37 @@ void _chip_8_add_i_reg(chip_8 *emu) {
     emu->_pc += 2;
 }
 
-void _chip_8_ld_f_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_ld_f_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     emu->_I = emu->_V[x] * 0x5;
     emu->_pc += 2;
 }
 
-void _chip_8_ld_b_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
-    emu->_memory[emu->_I] = emu->_V[x] / 100;
-    emu->_memory[emu->_I + 1] = (emu->_V[x] / 10) % 10;
-    emu->_memory[emu->_I + 2] = emu->_V[x] % 10;
+void _chip_8_ld_b_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
+    uint16_t addr = emu->_I & ADDR_MASK;
+    emu->_memory[addr] = emu->_V[x] / 100;
+    emu->_memory[(addr + 1) & ADDR_MASK] = (emu->_V[x] / 10) % 10;
+    emu->_memory[(addr + 2) & ADDR_MASK] = emu->_V[x] % 10;
+    _chip_8_predecode(emu, addr, 3);
     emu->_pc += 2;
 }
 
-void _chip_8_ld_i_reg(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_ld_i_reg(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     for (size_t i = 0; i <= x; ++i) {
-        emu->_memory[emu->_I + i] = emu->_V[i];
+        emu->_memory[(emu->_I + i) & ADDR_MASK] = emu->_V[i];
     }
+    _chip_8_predecode(emu, emu->_I & ADDR_MASK, x + 1);
 
     emu->_I += x + 1;
     emu->_pc += 2;
 }
 
-void _chip_8_ld_reg_i(chip_8 *emu) {
-    uint16_t x = (emu->_opcode & 0x0F00) >> 8;
+void _chip_8_ld_reg_i(chip_8 *emu, const chip_8_insn *insn) {
+    uint16_t x = insn->x;
     for (size_t i = 0; i <= x; ++i) {
-        emu->_V[i] = emu->_memory[emu->_I + i];
+        emu->_V[i] = emu->_memory[(emu->_I + i) & ADDR_MASK];
     }
 
     emu->_I += x + 1;
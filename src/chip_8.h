@@ -2,16 +2,239 @@
 #define CHIP_8_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #define MEMORY_SIZE   4096
 #define REGISTERS     16
 #define STACK_SIZE    64
-#define FB_SIZE       64 * 32
+#define FB_WIDTH      64
+#define FB_HEIGHT     32
+#define FB_SIZE       FB_WIDTH * FB_HEIGHT
 #define KEYMAP_SIZE   16
 #define FONTSET_SIZE  80
 #define MAX_FILE_SIZE MEMORY_SIZE - 512
 
+#define BLOCK_MAX_LEN    16
+#define BLOCK_CACHE_SIZE 256
+
+#define CODE_PAGE_SIZE   64
+#define CODE_PAGES       MEMORY_SIZE / CODE_PAGE_SIZE
+
+// Addresses wrap around at the end of memory, which needs MEMORY_SIZE to be a
+// power of two. Every access through _I or _pc is masked, so no ROM can reach
+// outside _memory.
+#define ADDR_MASK (MEMORY_SIZE - 1)
+
+// Only the low nibble of Vx selects a key for Ex9E and ExA1.
+#define KEY_MASK (KEYMAP_SIZE - 1)
+
+#define TIMER_HZ    60
+#define DEFAULT_IPS 700
+
+#define DEFAULT_SEED 0x2C0FFEE8
+
+// Longest loop chip_8_run_until fast-forwards while it waits for the delay
+// timer or a key, in instructions.
+#define IDLE_LOOP_LEN 8
+
+// The hot fields at the front of chip_8 share one line of this size.
+#define CACHE_LINE_SIZE 64
+
+// Power-of-two buckets of the per-instruction time histograms.
+#define PROFILE_BUCKETS 32
+
+// Average number of executions per timed one, a power of two.
+#define PROFILE_PERIOD 32
+
+// Timed executions this long were interrupted by the host and only go into
+// the histograms.
+#define PROFILE_INTERRUPTED (1 << 16)
+
+// Loops listed by chip_8_profile_report.
+#define PROFILE_TOP_LOOPS 10
+
+/**
+ * The instruction classes of the CHIP-8 instruction set.
+ *
+ * Every opcode decodes to exactly one of these, with CHIP_8_OP_UNKNOWN
+ * covering the opcodes that the emulator does not implement.
+ */
+typedef enum chip_8_op {
+    CHIP_8_OP_CLS,
+    CHIP_8_OP_RET,
+    CHIP_8_OP_JP,
+    CHIP_8_OP_CALL,
+    CHIP_8_OP_SE_BYTE,
+    CHIP_8_OP_SNE_BYTE,
+    CHIP_8_OP_SE_REG,
+    CHIP_8_OP_LD_BYTE,
+    CHIP_8_OP_ADD_BYTE,
+    CHIP_8_OP_LD_REG,
+    CHIP_8_OP_OR_REG,
+    CHIP_8_OP_AND_REG,
+    CHIP_8_OP_XOR_REG,
+    CHIP_8_OP_ADD_REG,
+    CHIP_8_OP_SUB_REG,
+    CHIP_8_OP_SHR,
+    CHIP_8_OP_SUBN_REG,
+    CHIP_8_OP_SHL,
+    CHIP_8_OP_SNE_REG,
+    CHIP_8_OP_LD_ADDR,
+    CHIP_8_OP_JP_REL,
+    CHIP_8_OP_RND,
+    CHIP_8_OP_DRW,
+    CHIP_8_OP_SKP,
+    CHIP_8_OP_SKNP,
+    CHIP_8_OP_LD_DT,
+    CHIP_8_OP_LD_K,
+    CHIP_8_OP_LD_DT_REG,
+    CHIP_8_OP_LD_ST_REG,
+    CHIP_8_OP_ADD_I_REG,
+    CHIP_8_OP_LD_F_REG,
+    CHIP_8_OP_LD_B_REG,
+    CHIP_8_OP_LD_I_REG,
+    CHIP_8_OP_LD_REG_I,
+    CHIP_8_OP_UNKNOWN,
+    CHIP_8_OP_COUNT
+} chip_8_op;
+
+/**
+ * A pre-decoded CHIP-8 instruction.
+ *
+ * Holds the instruction class, which indexes the handler that executes it,
+ * together with the operands already extracted from the opcode. Every
+ * instruction is two bytes long, so the length is not stored.
+ */
+typedef struct chip_8_insn {
+    uint16_t opcode;
+    uint16_t nnn;
+    uint8_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t kk;
+    uint8_t n;
+} chip_8_insn;
+
+/**
+ * Fused micro-ops of the basic-block cache.
+ *
+ * They are numbered after the instruction classes, so a micro-op is simply a
+ * chip_8_insn whose op may also be one of these.
+ */
+typedef enum chip_8_uop {
+    // 6xkk followed by Annn: x and kk from the first, nnn from the second.
+    CHIP_8_UOP_LD_BYTE_ADDR = CHIP_8_OP_COUNT,
+    // Annn followed by Dxyn: nnn from the first, x, y and n from the second.
+    CHIP_8_UOP_LD_ADDR_DRW,
+    CHIP_8_UOP_END
+} chip_8_uop;
+
+/**
+ * A translated basic block.
+ *
+ * A straight-line run of instructions starting at start and ending with the
+ * first jump, call, return, skip or Fx0A, stored as micro-ops.
+ */
+typedef struct chip_8_block {
+    uint16_t start;
+    uint8_t len;
+    uint8_t uop_count;
+    uint32_t executions;
+    chip_8_insn uops[BLOCK_MAX_LEN];
+} chip_8_block;
+
+/**
+ * Behaviors that CHIP-8 interpreters disagree on, as flags for
+ * chip_8_set_quirks.
+ */
+typedef enum chip_8_quirk {
+    // Sprite pixels past the right or bottom edge of the screen reappear on
+    // the opposite side instead of being clipped.
+    CHIP_8_QUIRK_WRAP = 1 << 0
+} chip_8_quirk;
+
+/**
+ * The faults an instruction can raise.
+ *
+ * A faulting instruction is not executed and the program counter stays on
+ * it. The fault is kept in the emulator, which then runs no further until
+ * the host clears it with chip_8_clear_fault.
+ */
+typedef enum chip_8_fault {
+    CHIP_8_FAULT_NONE = 0,
+    // The instruction is not a valid opcode.
+    CHIP_8_FAULT_UNKNOWN_OPCODE,
+    // 2nnn with all STACK_SIZE levels in use.
+    CHIP_8_FAULT_STACK_OVERFLOW,
+    // 00EE with an empty stack.
+    CHIP_8_FAULT_STACK_UNDERFLOW
+} chip_8_fault;
+
+/**
+ * The reasons a batch of cycles can stop.
+ *
+ * Except for CHIP_8_EXIT_BUDGET, each is a flag that can be combined into the
+ * stop mask of chip_8_run_until.
+ */
+typedef enum chip_8_exit {
+    // The cycle budget was used up.
+    CHIP_8_EXIT_BUDGET = 0,
+    // 00E0 or Dxyn was executed.
+    CHIP_8_EXIT_DRAW = 1 << 0,
+    // Fx0A is waiting for a key. Always stops the batch.
+    CHIP_8_EXIT_KEY_WAIT = 1 << 1,
+    // Fx18 turned the sound on.
+    CHIP_8_EXIT_SOUND = 1 << 2,
+    // The next instruction faulted, or the emulator already had a fault.
+    // Always stops the batch.
+    CHIP_8_EXIT_ERROR = 1 << 3,
+    // The batch ended in a loop that only a key press can leave. Reported
+    // instead of CHIP_8_EXIT_BUDGET when in stop; the budget is still used
+    // up.
+    CHIP_8_EXIT_IDLE = 1 << 4
+} chip_8_exit;
+
+/**
+ * The outcome of a batch of cycles.
+ */
+typedef struct chip_8_result {
+    uint32_t cycles;
+    uint32_t draws;
+    chip_8_exit reason;
+} chip_8_result;
+
+/**
+ * Execution counts and host time per instruction class, collected by builds
+ * with PROFILE=1.
+ *
+ * Every execution is counted, and about one in PROFILE_PERIOD, picked at
+ * random intervals so that loops do not alias with it, is timed with the host
+ * clock. hist[op][b] counts the timed executions that took from 2^(b - 1) to
+ * 2^b - 1 ticks, with b = 0 for none and the last bucket open-ended.
+ * run_ticks covers whole chip_8_run_until calls, so the time outside
+ * handlers is what fetching, dispatching and the timers cost. skipped counts
+ * the cycles of run_cycles that were fast-forwarded in waiting loops.
+ *
+ * heat counts the instructions fetched from every address.
+ */
+typedef struct chip_8_profile {
+    uint64_t count[CHIP_8_OP_COUNT];
+    uint64_t samples[CHIP_8_OP_COUNT];
+    uint64_t ticks[CHIP_8_OP_COUNT];
+    uint64_t hist[CHIP_8_OP_COUNT][PROFILE_BUCKETS];
+    uint64_t run_ticks;
+    uint64_t run_cycles;
+    uint64_t skipped;
+    uint64_t heat[MEMORY_SIZE];
+
+    // Executions left until the next timed one, and the xorshift32 state
+    // that draws the intervals.
+    uint32_t countdown;
+    uint32_t rng;
+} chip_8_profile;
+
 /**
  * The CHIP-8 hardware structure.
  *
@@ -19,23 +242,86 @@
  * the architecture of the systems on which CHIP-8 can run.
  */
 typedef struct chip_8 {
-    uint8_t _memory[MEMORY_SIZE];
-    uint8_t _V[REGISTERS];
+    // Everything a typical instruction reads or writes outside of memory,
+    // packed into the first cache line. Keep it within CACHE_LINE_SIZE bytes,
+    // which the assertion below enforces.
+    _Alignas(CACHE_LINE_SIZE) uint8_t _V[REGISTERS];
 
     uint16_t _I;
     uint16_t _pc;
     uint16_t _opcode;
-    
-    uint16_t _stack[STACK_SIZE];
     uint16_t _sp;
-    
+
     uint8_t _sound_timer;
     uint8_t _delay_timer;
 
-    uint8_t _framebuffer[FB_SIZE];
+    // Emulated clock. Every cycle adds TIMER_HZ to _timer_phase, and the
+    // timers tick each time it reaches _ips, so they run at 60 Hz of emulated
+    // time whatever the instruction rate.
+    uint32_t _timer_phase;
+    uint64_t _cycles;
+    uint32_t _ips;
+
+    // The fault that stopped the emulator, if any.
+    chip_8_fault _fault;
+
+    // xorshift64* state behind Cxkk, never zero.
+    uint64_t _rng;
+
+    // chip_8_quirk flags.
+    uint32_t _quirks;
+
+    // Rows changed since the frontend last presented, one bit per row. Set by
+    // the core, cleared by the frontend.
+    uint32_t _dirty_rows;
+
+    uint16_t _stack[STACK_SIZE];
     uint8_t _keymap[KEYMAP_SIZE];
+
+    // One word per row, with the leftmost pixel in the most significant bit.
+    uint64_t _framebuffer[FB_HEIGHT];
+
+    uint8_t _memory[MEMORY_SIZE];
+
+    // Decoded instruction starting at every address in memory, refreshed on
+    // load and whenever the program writes into memory. Odd addresses are
+    // included, since ROMs such as invaders.ch8 run entirely misaligned.
+    chip_8_insn _code[MEMORY_SIZE];
+
+    // Basic-block cache. _block_map holds the index + 1 of the block starting
+    // at each address, _block_cover marks the bytes inside any block.
+    chip_8_block _blocks[BLOCK_CACHE_SIZE];
+    uint16_t _block_count;
+    uint16_t _block_map[MEMORY_SIZE];
+    uint8_t _block_cover[MEMORY_SIZE];
+    uint32_t _block_flushes;
+
+    // Number of writes into each CODE_PAGE_SIZE page of memory, used by
+    // external translators such as the JIT to detect self-modifying code.
+    uint32_t _page_writes[CODE_PAGES];
+
+#ifdef CHIP_8_PROFILE
+    chip_8_profile _profile;
+#endif
 } chip_8;
 
+_Static_assert(offsetof(chip_8, _dirty_rows) + sizeof(uint32_t) <=
+                   CACHE_LINE_SIZE,
+               "The per-instruction state of chip_8 must fit in a cache line");
+
+/**
+ * Reads a pixel of the framebuffer.
+ *
+ * @param emu The emulator structure.
+ * @param x   The column, from 0 to FB_WIDTH - 1.
+ * @param y   The row, from 0 to FB_HEIGHT - 1.
+ * @return True if the pixel is set.
+ */
+static inline bool chip_8_pixel(const chip_8 *emu, size_t x, size_t y) {
+    return (emu->_framebuffer[y] >> (FB_WIDTH - 1 - x)) & 1;
+}
+
+
 /**
  * Initializes the CHIP-8 structure by setting all of the memory fields to
  * zero, initializing the fontset and setting the program counter to 0x200.
@@ -53,252 +339,469 @@ void chip_8_init(chip_8 *emu);
  */
 bool chip_8_load(chip_8 *emu, const char *path);
 
+/**
+ * Loads a ROM that is already in memory into the memory of the emulator.
+ *
+ * @param emu  The emulator structure.
+ * @param rom  The ROM data.
+ * @param size The size of the ROM in bytes.
+ * @return True if the ROM is loaded successfully, False otherwise.
+ */
+bool chip_8_load_rom(chip_8 *emu, const uint8_t *rom, size_t size);
+
 /**
  * Emulates one cycle of the program, processing a single opcode.
  *
+ * Does nothing while the emulator has a fault; an instruction that faults
+ * sets _fault instead of executing.
+ *
  * @param emu The emulator structure.
+ * @return True if the instruction drew to the screen.
  */
 bool chip_8_emulate_cycle(chip_8 *emu);
 
+/**
+ * Emulates up to max_cycles cycles in one call.
+ *
+ * Uses a direct-threaded interpreter built on labels-as-values, where each
+ * handler dispatches the next instruction itself; compilers without
+ * labels-as-values get a plain fetch and execute loop. The batch ends when
+ * the budget is used up, when Fx0A is waiting for a key, on a fault, or on
+ * any event in stop. Cycles that end the batch without executing, the Fx0A
+ * wait and the faulting instruction, are not counted.
+ *
+ * A backward 1nnn that closes a loop of at most IDLE_LOOP_LEN instructions
+ * which only compare registers, read keys or the delay timer and load
+ * registers, and which leaves them unchanged, is waiting. Whole iterations of
+ * it are skipped by advancing the clock and the timers, up to the next delay
+ * timer tick if the loop reads the timer, with the same result as running
+ * them.
+ *
+ * @param emu        The emulator structure.
+ * @param max_cycles The maximum number of cycles to run.
+ * @param stop       The chip_8_exit flags that end the batch.
+ * @return The cycles executed, the screen updates and why the batch ended.
+ */
+chip_8_result chip_8_run_until(chip_8 *emu, uint32_t max_cycles,
+                               unsigned stop);
+
+/**
+ * Emulates a number of cycles, drawing included.
+ *
+ * Stops early only when Fx0A is waiting for a key or on a fault.
+ *
+ * @param emu    The emulator structure.
+ * @param cycles The number of cycles to run.
+ * @return The cycles executed, the screen updates and why the batch ended.
+ */
+chip_8_result chip_8_step_n(chip_8 *emu, uint32_t cycles);
+
+/**
+ * Emulates up to max_cycles cycles, stopping after the first draw.
+ *
+ * Also stops on a fault, which is left in _fault.
+ *
+ * @param emu        The emulator structure.
+ * @param max_cycles The maximum number of cycles to run.
+ * @param draw       Set to whether the last instruction drew.
+ * @return The number of cycles executed.
+ */
+uint32_t chip_8_run(chip_8 *emu, uint32_t max_cycles, bool *draw);
+
+/**
+ * Decodes an opcode into its instruction class.
+ *
+ * This is used to fill the pre-decoded instruction cache of the emulator,
+ * which chip_8_emulate_cycle then dispatches on, either through a switch or,
+ * when built with CHIP_8_DISPATCH_TABLE, through a handler table.
+ *
+ * @param opcode The raw 16-bit opcode.
+ * @return The instruction class of the opcode.
+ */
+chip_8_op chip_8_decode(uint16_t opcode);
+
+/**
+ * Sets the emulated clock rate.
+ *
+ * The delay and sound timers tick TIMER_HZ times per ips cycles. Rates below
+ * TIMER_HZ are raised to it.
+ *
+ * @param emu The emulator structure.
+ * @param ips The number of instructions per emulated second.
+ */
+void chip_8_set_ips(chip_8 *emu, uint32_t ips);
+
+/**
+ * Selects the quirks the emulator follows.
+ *
+ * chip_8_init starts with none, so sprites are clipped at the screen edges.
+ *
+ * @param emu    The emulator structure.
+ * @param quirks The chip_8_quirk flags to enable.
+ */
+void chip_8_set_quirks(chip_8 *emu, unsigned quirks);
+
+/**
+ * Clears the fault of the emulator so that it runs again.
+ *
+ * @param emu  The emulator structure.
+ * @param skip Whether to step over the faulting instruction rather than
+ *             retry it.
+ */
+void chip_8_clear_fault(chip_8 *emu, bool skip);
+
+/**
+ * Describes a fault.
+ *
+ * @param fault The fault.
+ * @return A human readable description.
+ */
+const char *chip_8_fault_name(chip_8_fault fault);
+
+/**
+ * Seeds the random number generator behind Cxkk.
+ *
+ * Runs with the same seed, ROM and input are identical. chip_8_init seeds
+ * with DEFAULT_SEED.
+ *
+ * @param emu  The emulator structure.
+ * @param seed Any value, including 0.
+ */
+void chip_8_seed(chip_8 *emu, uint64_t seed);
+
+/**
+ * Re-decodes the cached instructions overlapping memory[addr, addr + len).
+ *
+ * Called after anything writes into memory, so self-modifying code is seen.
+ * Writes into translated blocks flush the whole block cache. A range that
+ * runs past the end of memory continues at address 0.
+ *
+ * @param emu  The emulator structure.
+ * @param addr The first address written, below MEMORY_SIZE.
+ * @param len  The number of bytes written.
+ */
+void _chip_8_predecode(chip_8 *emu, size_t addr, size_t len);
+
+/**
+ * Replaces the whole memory with an image.
+ *
+ * Only the bytes that differ are written and re-decoded, so restoring an
+ * earlier state of the same game leaves the caches mostly intact.
+ *
+ * @param emu   The emulator structure.
+ * @param image MEMORY_SIZE bytes of new memory contents.
+ */
+void _chip_8_write_memory(chip_8 *emu, const uint8_t *image);
+
+/**
+ * Advances the clock by the given number of already executed cycles.
+ *
+ * Used by engines that execute several instructions natively before handing
+ * control back, so that timers stay in step with the interpreter.
+ *
+ * @param emu    The emulator structure.
+ * @param cycles The number of cycles executed.
+ */
+void _chip_8_advance(chip_8 *emu, uint32_t cycles);
+
+/**
+ * Emulates one basic block of the program.
+ *
+ * The block starting at the program counter is translated into fused
+ * micro-ops on first use and executed from the block cache afterwards. The
+ * clock advances once per instruction, exactly as with chip_8_emulate_cycle.
+ * Does nothing while the emulator has a fault.
+ *
+ * @param emu The emulator structure.
+ * @return The number of instructions in the block that drew to the screen.
+ */
+uint32_t chip_8_emulate_block(chip_8 *emu);
+
+/**
+ * Prints every cached block with its length, fusions and execution count,
+ * most executed first, followed by the executions of each fusion.
+ *
+ * @param emu The emulator structure.
+ * @param out The stream to print to.
+ */
+void chip_8_dump_blocks(const chip_8 *emu, FILE *out);
+
 
 // Instructions.
 
 /**
  * 0x00E0 - Clear the display.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_cls(chip_8 *emu);
+void _chip_8_cls(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x00EE - Returns from the subroutine.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ret(chip_8 *emu);
+void _chip_8_ret(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x1nnn - Jump to the location nnn.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_jp(chip_8 *emu);
+void _chip_8_jp(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x2nnn - Call subroutine at nnn.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_call(chip_8 *emu);
+void _chip_8_call(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x3xkk - Skip next instruction if Vx == kk.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_se_byte(chip_8 *emu);
+void _chip_8_se_byte(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x4xkk - Skip next instruction if Vx != kk.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_sne_byte(chip_8 *emu);
+void _chip_8_sne_byte(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x5xy0 - Skip next instruction if Vx = Vy.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_se_reg(chip_8 *emu);
+void _chip_8_se_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x6xkk - Set Vx = kk.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_byte(chip_8 *emu);
+void _chip_8_ld_byte(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x7xkk - Set Vx = Vx + kk.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_add_byte(chip_8 *emu);
+void _chip_8_add_byte(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy0 - Set Vx = Vy.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_reg(chip_8 *emu);
+void _chip_8_ld_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy1 - Set Vx = Vx OR Vy.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_or_reg(chip_8 *emu);
+void _chip_8_or_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy2 - Set Vx = Vx AND Vy.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_and_reg(chip_8 *emu);
+void _chip_8_and_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy3 - Set Vx = Vx XOR Vy.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_xor_reg(chip_8 *emu);
+void _chip_8_xor_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy4 - Set Vx = Vx + Vy, set VF = carry.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_add_reg(chip_8 *emu);
+void _chip_8_add_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy5 - Set Vx = Vx - Vy, set VF = NOT borrow.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_sub_reg(chip_8 *emu);
+void _chip_8_sub_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy6 - Set Vx = Vx SHR 1. If least-significant bit of Vx is 1, then set VF to 1, otherwise 0.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_shr(chip_8 *emu);
+void _chip_8_shr(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xy7 - Set Vx = Vy - Vx, set VF = NOT borrow.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_subn_reg(chip_8 *emu);
+void _chip_8_subn_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x8xyE - Set Vx = Vx SHL 1. If the most-significant bit of Vx is 1, then set VF to 1, otherwise 0.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_shl(chip_8 *emu);
+void _chip_8_shl(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0x9xy0 - Skip next instruction if Vx != Vy.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_sne_reg(chip_8 *emu);
+void _chip_8_sne_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xAnnn - Set I = nnn.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_addr(chip_8 *emu);
+void _chip_8_ld_addr(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xBnnn - Jump to location nnn + V0.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_jp_rel(chip_8 *emu);
+void _chip_8_jp_rel(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xCxkk - Set Vx = random byte AND kk.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_rnd(chip_8 *emu);
+void _chip_8_rnd(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xDxyn - Display n-byte sprite starting at memory location I at (Vx, Vy), set VF = collision.
  *
- * @param emu The emulator structure.
+ * The position wraps onto the screen. Pixels past its edges are clipped, or
+ * wrap around with CHIP_8_QUIRK_WRAP.
+ *
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_drw(chip_8 *emu);
+void _chip_8_drw(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xEx9E - Skip next instruction if key with the value of Vx is pressed.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_skp(chip_8 *emu);
+void _chip_8_skp(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xExA1 - Skip next instruction if key with the value of Vx is not pressed.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_sknp(chip_8 *emu);
+void _chip_8_sknp(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx07 - Set Vx = delay timer.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_dt(chip_8 *emu);
+void _chip_8_ld_dt(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx0A - Wait for a key press, store the vlaue of the key in Vx.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-bool _chip_8_ld_k(chip_8 *emu);
+bool _chip_8_ld_k(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx15 - Set delay timer = Vx.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_dt_reg(chip_8 *emu);
+void _chip_8_ld_dt_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx18 - Set sound timer = Vx.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_st_reg(chip_8 *emu);
+void _chip_8_ld_st_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx1E - Set I = I + Vx.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_add_i_reg(chip_8 *emu);
+void _chip_8_add_i_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx29 - Set I = location of sprite for digit Vx.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_f_reg(chip_8 *emu);
+void _chip_8_ld_f_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx33 - Store BCD representation of Vx in memory locations I, I + 1, I + 2.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_b_reg(chip_8 *emu);
+void _chip_8_ld_b_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx55 - Store V0 to Vx in memory starting at address I.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_i_reg(chip_8 *emu);
+void _chip_8_ld_i_reg(chip_8 *emu, const chip_8_insn *insn);
 
 /**
  * 0xFx65 - Fills V0 to Vx with values from memory starting at address x.
  *
- * @param emu The emulator structure.
+ * @param emu  The emulator structure.
+ * @param insn The decoded instruction.
  */
-void _chip_8_ld_reg_i(chip_8 *emu);
+void _chip_8_ld_reg_i(chip_8 *emu, const chip_8_insn *insn);
 
 #endif // CHIP_8_H
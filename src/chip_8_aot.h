@@ -0,0 +1,42 @@
+#ifndef CHIP_8_AOT_H
+#define CHIP_8_AOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip_8.h"
+
+/**
+ * The interface of a translation unit generated by chip8-aot.
+ *
+ * The static recompiler turns every instruction reachable from 0x200 into a
+ * label with inline C, with direct gotos for jumps, calls and skips. Computed
+ * jumps, returns and anything outside the translation go back through a
+ * switch on the program counter, and addresses it does not cover, as well as
+ * instructions that no longer hold the opcode they were translated from, are
+ * left to the interpreter.
+ */
+
+/**
+ * The ROM the translation was generated from.
+ */
+extern const uint8_t chip_8_aot_rom[];
+extern const size_t chip_8_aot_rom_size;
+
+/**
+ * Runs translated code from the program counter.
+ *
+ * Returns after max_cycles cycles, after an instruction that draws, when
+ * Fx0A is waiting for a key, or when the program counter leaves the
+ * translated code. Zero cycles means the next instruction has to be run by
+ * chip_8_emulate_cycle, which also raises any fault.
+ *
+ * @param emu        The emulator structure.
+ * @param max_cycles The maximum number of cycles to run.
+ * @param draw       Set to whether the executed instructions drew.
+ * @return The number of cycles executed.
+ */
+uint32_t chip_8_aot_run(chip_8 *emu, uint32_t max_cycles, bool *draw);
+
+#endif // CHIP_8_AOT_H
@@ -0,0 +1,485 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "chip_8_jit.h"
+
+#if defined(CHIP_8_JIT) && defined(__x86_64__)
+
+#include <sys/mman.h>
+
+enum {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSI = 6,
+    RDI = 7,
+    R8 = 8,
+    R9 = 9,
+    R10 = 10,
+    R11 = 11,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+    R15 = 15
+};
+
+enum { CC_C = 0x2, CC_NC = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_A = 0x7 };
+
+// Host registers the V registers of a block are allocated to, caller-saved
+// ones first. rax and rcx are scratch, esi holds I and rdi the emulator.
+static const uint8_t chip_8_jit_pool[] = {
+    RDX, R8, R9, R10, R11, RBX, R12, R13, R14, R15};
+
+#define POOL_SIZE (sizeof(chip_8_jit_pool) / sizeof(chip_8_jit_pool[0]))
+
+static inline void _emit8(uint8_t **p, uint8_t byte) { *(*p)++ = byte; }
+
+static inline void _emit16(uint8_t **p, uint16_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+static inline void _emit32(uint8_t **p, uint32_t value) {
+    memcpy(*p, &value, sizeof(value));
+    *p += sizeof(value);
+}
+
+// A REX prefix is always emitted for byte registers, so that r8b-r15b can be
+// encoded and indices 4-7 never select ah-bh.
+static inline uint8_t _rex(uint8_t reg, uint8_t rm) {
+    return 0x40 | ((reg >> 3) & 1) << 2 | ((rm >> 3) & 1);
+}
+
+static inline bool _callee_saved(uint8_t reg) {
+    return reg == RBX || reg >= R12;
+}
+
+static void _emit_push(uint8_t **p, uint8_t reg) {
+    if (reg >= R8) {
+        _emit8(p, 0x41);
+    }
+    _emit8(p, 0x50 + (reg & 7));
+}
+
+static void _emit_pop(uint8_t **p, uint8_t reg) {
+    if (reg >= R8) {
+        _emit8(p, 0x41);
+    }
+    _emit8(p, 0x58 + (reg & 7));
+}
+
+// mov r8, imm8
+static void _emit_mov_imm(uint8_t **p, uint8_t reg, uint8_t imm) {
+    _emit8(p, _rex(0, reg));
+    _emit8(p, 0xB0 + (reg & 7));
+    _emit8(p, imm);
+}
+
+// add/cmp r8, imm8, selected by the /ext field of opcode 0x80.
+static void _emit_alu_imm(uint8_t **p, uint8_t ext, uint8_t reg, uint8_t imm) {
+    _emit8(p, _rex(0, reg));
+    _emit8(p, 0x80);
+    _emit8(p, 0xC0 | ext << 3 | (reg & 7));
+    _emit8(p, imm);
+}
+
+// mov/add/or/and/sub/xor/cmp r8, r8 in their "op r/m8, r8" forms.
+static void _emit_alu(uint8_t **p, uint8_t opcode, uint8_t dst, uint8_t src) {
+    _emit8(p, _rex(src, dst));
+    _emit8(p, opcode);
+    _emit8(p, 0xC0 | (src & 7) << 3 | (dst & 7));
+}
+
+static void _emit_setcc(uint8_t **p, uint8_t cc, uint8_t reg) {
+    _emit8(p, _rex(0, reg));
+    _emit8(p, 0x0F);
+    _emit8(p, 0x90 | cc);
+    _emit8(p, 0xC0 | (reg & 7));
+}
+
+// shl/shr r8, 1, selected by the /ext field of opcode 0xD0.
+static void _emit_shift(uint8_t **p, uint8_t ext, uint8_t reg) {
+    _emit8(p, _rex(0, reg));
+    _emit8(p, 0xD0);
+    _emit8(p, 0xC0 | ext << 3 | (reg & 7));
+}
+
+// mov r8, [rdi + disp32] (load) or mov [rdi + disp32], r8 (store).
+static void _emit_mem(uint8_t **p, uint8_t opcode, uint8_t reg, uint32_t disp) {
+    _emit8(p, _rex(reg, 0));
+    _emit8(p, opcode);
+    _emit8(p, 0x80 | (reg & 7) << 3 | RDI);
+    _emit32(p, disp);
+}
+
+// movzx eax, r8
+static void _emit_movzx_eax(uint8_t **p, uint8_t reg) {
+    _emit8(p, _rex(0, reg));
+    _emit8(p, 0x0F);
+    _emit8(p, 0xB6);
+    _emit8(p, 0xC0 | (reg & 7));
+}
+
+// Reports the V registers an instruction touches, or false if the JIT does
+// not translate it. Instructions setting VF are only translated when neither
+// operand is VF, since the interpreter's ordering matters in that case.
+static bool _chip_8_jit_supported(const chip_8_insn *insn, uint16_t *regs) {
+    uint16_t x = 1 << insn->x;
+    uint16_t y = 1 << insn->y;
+    uint16_t f = 1 << 0xF;
+
+    switch (insn->op) {
+    case CHIP_8_OP_JP:
+    case CHIP_8_OP_LD_ADDR:
+        *regs = 0;
+        return true;
+    case CHIP_8_OP_LD_BYTE:
+    case CHIP_8_OP_ADD_BYTE:
+    case CHIP_8_OP_SE_BYTE:
+    case CHIP_8_OP_SNE_BYTE:
+    case CHIP_8_OP_LD_F_REG:
+        *regs = x;
+        return true;
+    case CHIP_8_OP_LD_REG:
+    case CHIP_8_OP_OR_REG:
+    case CHIP_8_OP_AND_REG:
+    case CHIP_8_OP_XOR_REG:
+    case CHIP_8_OP_SE_REG:
+    case CHIP_8_OP_SNE_REG:
+        *regs = x | y;
+        return true;
+    case CHIP_8_OP_ADD_REG:
+    case CHIP_8_OP_SUB_REG:
+    case CHIP_8_OP_SUBN_REG:
+        *regs = x | y | f;
+        return insn->x != 0xF && insn->y != 0xF;
+    case CHIP_8_OP_SHR:
+    case CHIP_8_OP_SHL:
+    case CHIP_8_OP_ADD_I_REG:
+        *regs = x | f;
+        return insn->x != 0xF;
+    default:
+        return false;
+    }
+}
+
+// Sums the write counters of the pages holding the len instructions at start.
+static uint32_t _chip_8_jit_pages(const chip_8 *emu,
+    uint16_t start,
+    uint8_t len) {
+    size_t end = start + 2 * (len > 0 ? len : 1);
+    if (end > MEMORY_SIZE) {
+        end = MEMORY_SIZE;
+    }
+
+    uint32_t pages = 0;
+    size_t last = (end - 1) / CODE_PAGE_SIZE;
+    for (size_t page = start / CODE_PAGE_SIZE; page <= last; page++) {
+        pages += emu->_page_writes[page];
+    }
+    return pages;
+}
+
+static void _chip_8_jit_flush(chip_8_jit *jit) {
+    jit->code_used = 0;
+    memset(jit->blocks, 0, sizeof(jit->blocks));
+    jit->flushes++;
+}
+
+static void _chip_8_jit_compile(chip_8_jit *jit, chip_8 *emu, uint16_t start) {
+    chip_8_jit_block *block = &jit->blocks[start];
+
+    int8_t host[REGISTERS];
+    uint8_t order[REGISTERS];
+    size_t allocated = 0;
+    uint8_t len = 0;
+
+    memset(host, -1, sizeof(host));
+
+    // Find how far the block reaches, allocating a host register to every V
+    // register it touches.
+    for (size_t addr = start; len < BLOCK_MAX_LEN && addr + 1 < MEMORY_SIZE;
+         addr += 2) {
+        const chip_8_insn *insn = &emu->_code[addr];
+        uint16_t regs;
+
+        if (!_chip_8_jit_supported(insn, &regs)) {
+            break;
+        }
+
+        size_t needed = 0;
+        for (size_t v = 0; v < REGISTERS; v++) {
+            needed += (regs >> v & 1) && host[v] < 0;
+        }
+        if (allocated + needed > POOL_SIZE) {
+            break;
+        }
+
+        for (size_t v = 0; v < REGISTERS; v++) {
+            if ((regs >> v & 1) && host[v] < 0) {
+                host[v] = chip_8_jit_pool[allocated];
+                order[allocated++] = v;
+            }
+        }
+
+        len++;
+
+        if (insn->op == CHIP_8_OP_JP || insn->op == CHIP_8_OP_SE_BYTE ||
+            insn->op == CHIP_8_OP_SNE_BYTE || insn->op == CHIP_8_OP_SE_REG ||
+            insn->op == CHIP_8_OP_SNE_REG) {
+            break;
+        }
+    }
+
+    block->len = len;
+    block->pages = _chip_8_jit_pages(emu, start, len);
+
+    if (len == 0) {
+        block->state = CHIP_8_JIT_UNSUPPORTED;
+        return;
+    }
+
+    if (jit->code_used + JIT_MAX_BLOCK > JIT_CODE_SIZE) {
+        _chip_8_jit_flush(jit);
+        block->len = len;
+        block->pages = _chip_8_jit_pages(emu, start, len);
+    }
+
+    const uint32_t v_offset = offsetof(chip_8, _V);
+    const uint32_t i_offset = offsetof(chip_8, _I);
+    const uint32_t pc_offset = offsetof(chip_8, _pc);
+
+    uint8_t *entry = jit->code + jit->code_used;
+    uint8_t *p = entry;
+
+    // Prologue: save the callee-saved registers in use, then load I and the
+    // V registers of the block into host registers.
+    for (size_t i = 0; i < allocated; i++) {
+        if (_callee_saved(chip_8_jit_pool[i])) {
+            _emit_push(&p, chip_8_jit_pool[i]);
+        }
+    }
+
+    _emit8(&p, 0x0F); // movzx esi, word [rdi + I]
+    _emit8(&p, 0xB7);
+    _emit8(&p, 0x80 | RSI << 3 | RDI);
+    _emit32(&p, i_offset);
+
+    for (size_t i = 0; i < allocated; i++) {
+        _emit_mem(&p, 0x8A, host[order[i]], v_offset + order[i]);
+    }
+
+    // Body. The exit either stores a constant program counter or, for skips,
+    // selects between two with cmov on the flags of the final compare.
+    uint16_t addr = start;
+    uint16_t exit_pc = start + 2 * len;
+    int8_t exit_cc = -1;
+
+    for (uint8_t n = 0; n < len; n++, addr += 2) {
+        const chip_8_insn *insn = &emu->_code[addr];
+        uint8_t vx = host[insn->x];
+        uint8_t vy = host[insn->y];
+        uint8_t vf = host[0xF];
+
+        switch (insn->op) {
+        case CHIP_8_OP_JP:
+            exit_pc = insn->nnn;
+            break;
+        case CHIP_8_OP_SE_BYTE:
+        case CHIP_8_OP_SNE_BYTE:
+            _emit_alu_imm(&p, 7, vx, insn->kk);
+            exit_cc = insn->op == CHIP_8_OP_SE_BYTE ? CC_E : CC_NE;
+            break;
+        case CHIP_8_OP_SE_REG:
+        case CHIP_8_OP_SNE_REG:
+            _emit_alu(&p, 0x38, vx, vy);
+            exit_cc = insn->op == CHIP_8_OP_SE_REG ? CC_E : CC_NE;
+            break;
+        case CHIP_8_OP_LD_BYTE:
+            _emit_mov_imm(&p, vx, insn->kk);
+            break;
+        case CHIP_8_OP_ADD_BYTE:
+            _emit_alu_imm(&p, 0, vx, insn->kk);
+            break;
+        case CHIP_8_OP_LD_REG:
+            _emit_alu(&p, 0x88, vx, vy);
+            break;
+        case CHIP_8_OP_OR_REG:
+            _emit_alu(&p, 0x08, vx, vy);
+            break;
+        case CHIP_8_OP_AND_REG:
+            _emit_alu(&p, 0x20, vx, vy);
+            break;
+        case CHIP_8_OP_XOR_REG:
+            _emit_alu(&p, 0x30, vx, vy);
+            break;
+        case CHIP_8_OP_ADD_REG:
+            _emit_alu(&p, 0x00, vx, vy);
+            _emit_setcc(&p, CC_C, vf);
+            break;
+        case CHIP_8_OP_SUB_REG:
+            _emit_alu(&p, 0x28, vx, vy);
+            _emit_setcc(&p, CC_C, vf);
+            break;
+        case CHIP_8_OP_SUBN_REG:
+            _emit_alu(&p, 0x88, RAX, vy);
+            _emit_alu(&p, 0x28, RAX, vx);
+            _emit_setcc(&p, CC_NC, vf);
+            _emit_alu(&p, 0x88, vx, RAX);
+            break;
+        case CHIP_8_OP_SHR:
+            _emit_shift(&p, 5, vx);
+            _emit_setcc(&p, CC_C, vf);
+            break;
+        case CHIP_8_OP_SHL:
+            _emit_shift(&p, 4, vx);
+            _emit_setcc(&p, CC_C, vf);
+            break;
+        case CHIP_8_OP_LD_ADDR:
+            _emit8(&p, 0xBE); // mov esi, imm32
+            _emit32(&p, insn->nnn);
+            break;
+        case CHIP_8_OP_ADD_I_REG:
+            _emit_movzx_eax(&p, vx);
+            _emit8(&p, 0x01); // add esi, eax
+            _emit8(&p, 0xC6);
+            _emit8(&p, 0x81); // cmp esi, 0xFFF
+            _emit8(&p, 0xFE);
+            _emit32(&p, 0xFFF);
+            _emit_setcc(&p, CC_A, vf);
+            _emit8(&p, 0x81); // and esi, 0xFFFF
+            _emit8(&p, 0xE6);
+            _emit32(&p, 0xFFFF);
+            break;
+        case CHIP_8_OP_LD_F_REG:
+            _emit_movzx_eax(&p, vx);
+            _emit8(&p, 0x8D); // lea esi, [rax + rax * 4]
+            _emit8(&p, 0x34);
+            _emit8(&p, 0x80);
+            break;
+        }
+    }
+
+    // Epilogue: none of these instructions touch the flags a skip left.
+    if (exit_cc >= 0) {
+        uint16_t last = start + 2 * (len - 1);
+        _emit8(&p, 0xB8); // mov eax, last + 2
+        _emit32(&p, last + 2);
+        _emit8(&p, 0xB9); // mov ecx, last + 4
+        _emit32(&p, last + 4);
+        _emit8(&p, 0x0F); // cmovcc eax, ecx
+        _emit8(&p, 0x40 | exit_cc);
+        _emit8(&p, 0xC0 | RAX << 3 | RCX);
+        _emit8(&p, 0x66); // mov [rdi + pc], ax
+        _emit8(&p, 0x89);
+        _emit8(&p, 0x80 | RAX << 3 | RDI);
+        _emit32(&p, pc_offset);
+    } else {
+        _emit8(&p, 0x66); // mov word [rdi + pc], imm16
+        _emit8(&p, 0xC7);
+        _emit8(&p, 0x80 | RDI);
+        _emit32(&p, pc_offset);
+        _emit16(&p, exit_pc);
+    }
+
+    for (size_t i = 0; i < allocated; i++) {
+        _emit_mem(&p, 0x88, host[order[i]], v_offset + order[i]);
+    }
+
+    _emit8(&p, 0x66); // mov [rdi + I], si
+    _emit8(&p, 0x89);
+    _emit8(&p, 0x80 | RSI << 3 | RDI);
+    _emit32(&p, i_offset);
+
+    for (size_t i = allocated; i-- > 0;) {
+        if (_callee_saved(chip_8_jit_pool[i])) {
+            _emit_pop(&p, chip_8_jit_pool[i]);
+        }
+    }
+    _emit8(&p, 0xC3); // ret
+
+    block->offset = entry - jit->code;
+    block->state = CHIP_8_JIT_COMPILED;
+    jit->code_used += p - entry;
+    jit->compiled++;
+}
+
+bool chip_8_jit_init(chip_8_jit *jit) {
+    memset(jit, 0, sizeof(*jit));
+
+    void *code = mmap(NULL,
+        JIT_CODE_SIZE,
+        PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS,
+        -1,
+        0);
+    if (code == MAP_FAILED) {
+        return false;
+    }
+
+    jit->code = code;
+    return true;
+}
+
+void chip_8_jit_free(chip_8_jit *jit) {
+    if (jit->code != NULL) {
+        munmap(jit->code, JIT_CODE_SIZE);
+        jit->code = NULL;
+    }
+}
+
+uint32_t chip_8_jit_emulate_block(chip_8_jit *jit, chip_8 *emu) {
+    if (jit->code == NULL || emu->_pc >= MEMORY_SIZE ||
+        emu->_fault != CHIP_8_FAULT_NONE) {
+        return chip_8_emulate_block(emu);
+    }
+
+    uint16_t pc = emu->_pc;
+    chip_8_jit_block *block = &jit->blocks[pc];
+
+    // The program wrote into the pages the block was translated from.
+    if (block->state != CHIP_8_JIT_COLD &&
+        block->pages != _chip_8_jit_pages(emu, pc, block->len)) {
+        block->state = CHIP_8_JIT_COLD;
+    }
+
+    if (block->state == CHIP_8_JIT_COLD) {
+        if (block->hits < JIT_THRESHOLD) {
+            block->hits++;
+            return chip_8_emulate_block(emu);
+        }
+        _chip_8_jit_compile(jit, emu, pc);
+    }
+
+    // The block cache runs untranslatable code up to where the JIT can take
+    // over again, rather than a single instruction per call.
+    if (block->state == CHIP_8_JIT_UNSUPPORTED) {
+        return chip_8_emulate_block(emu);
+    }
+
+    void (*run)(chip_8 *emu);
+    uint8_t *entry = jit->code + block->offset;
+    memcpy(&run, &entry, sizeof(run));
+
+    // None of the translated instructions draw.
+    run(emu);
+    _chip_8_advance(emu, block->len);
+
+    return 0;
+}
+
+#else
+
+bool chip_8_jit_init(chip_8_jit *jit) {
+    memset(jit, 0, sizeof(*jit));
+    return false;
+}
+
+void chip_8_jit_free(chip_8_jit *jit) {}
+
+uint32_t chip_8_jit_emulate_block(chip_8_jit *jit, chip_8 *emu) {
+    return chip_8_emulate_block(emu);
+}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef CHIP_8_JIT_H
+#define CHIP_8_JIT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip_8.h"
+
+#define JIT_CODE_SIZE  256 * 1024
+#define JIT_THRESHOLD  16
+#define JIT_MAX_BLOCK  1024
+
+/**
+ * The state of a JIT block starting at a given address.
+ */
+typedef enum chip_8_jit_state {
+    CHIP_8_JIT_COLD,
+    CHIP_8_JIT_COMPILED,
+    CHIP_8_JIT_UNSUPPORTED
+} chip_8_jit_state;
+
+/**
+ * A block of CHIP-8 instructions compiled to native code.
+ *
+ * pages holds the sum of the write counters of the memory pages the block
+ * was compiled from, so a write into any of them invalidates the block.
+ */
+typedef struct chip_8_jit_block {
+    uint32_t offset;
+    uint32_t pages;
+    uint16_t hits;
+    uint8_t len;
+    uint8_t state;
+} chip_8_jit_block;
+
+/**
+ * The x86-64 dynamic recompiler.
+ *
+ * Blocks that run at least JIT_THRESHOLD times are translated into native
+ * code in an executable buffer. Within a block the V registers it uses live
+ * in host registers, I lives in esi and the program counter is only written
+ * on exit. A JIT belongs to a single emulator instance.
+ */
+typedef struct chip_8_jit {
+    uint8_t *code;
+    size_t code_used;
+
+    chip_8_jit_block blocks[MEMORY_SIZE];
+
+    uint32_t compiled;
+    uint32_t flushes;
+} chip_8_jit;
+
+/**
+ * Initializes the JIT and maps its executable code buffer.
+ *
+ * @param jit The JIT structure.
+ * @return True if the JIT is available, False if the emulator was built
+ *         without JIT=1, the host is not x86-64 or the buffer could not be
+ *         mapped. chip_8_jit_emulate_block still works in that case, but
+ *         only interprets.
+ */
+bool chip_8_jit_init(chip_8_jit *jit);
+
+/**
+ * Unmaps the code buffer of the JIT.
+ *
+ * @param jit The JIT structure.
+ */
+void chip_8_jit_free(chip_8_jit *jit);
+
+/**
+ * Emulates one block of the program, natively if it has been compiled.
+ *
+ * Cold blocks are run by chip_8_emulate_block until they become hot.
+ * Instructions the JIT cannot translate are interpreted one at a time.
+ *
+ * @param jit The JIT structure.
+ * @param emu The emulator structure.
+ * @return The number of executed instructions that drew to the screen.
+ */
+uint32_t chip_8_jit_emulate_block(chip_8_jit *jit, chip_8 *emu);
+
+#endif // CHIP_8_JIT_H
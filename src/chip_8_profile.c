@@ -0,0 +1,432 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip_8_profile.h"
+
+#ifdef CHIP_8_PROFILE
+
+// The overhead of a sample is the least of a few batches, which leaves out
+// interrupts and frequency changes.
+#define CALIBRATION_BATCHES 16
+#define CALIBRATION_ROUNDS  4096
+
+// Longest loop without side effects that still counts as waiting.
+#define WAIT_LOOP_LEN 4
+
+// Heatmap image size, one pixel per address.
+#define HEATMAP_WIDTH  64
+#define HEATMAP_HEIGHT (MEMORY_SIZE / HEATMAP_WIDTH)
+
+/**
+ * An instruction class as it appears in the report.
+ */
+typedef struct chip_8_profile_name {
+    const char *pattern;
+    const char *handler;
+} chip_8_profile_name;
+
+static const chip_8_profile_name chip_8_profile_names[CHIP_8_OP_COUNT] = {
+    [CHIP_8_OP_CLS] = {"00E0", "_chip_8_cls"},
+    [CHIP_8_OP_RET] = {"00EE", "_chip_8_ret"},
+    [CHIP_8_OP_JP] = {"1nnn", "_chip_8_jp"},
+    [CHIP_8_OP_CALL] = {"2nnn", "_chip_8_call"},
+    [CHIP_8_OP_SE_BYTE] = {"3xkk", "_chip_8_se_byte"},
+    [CHIP_8_OP_SNE_BYTE] = {"4xkk", "_chip_8_sne_byte"},
+    [CHIP_8_OP_SE_REG] = {"5xy0", "_chip_8_se_reg"},
+    [CHIP_8_OP_LD_BYTE] = {"6xkk", "_chip_8_ld_byte"},
+    [CHIP_8_OP_ADD_BYTE] = {"7xkk", "_chip_8_add_byte"},
+    [CHIP_8_OP_LD_REG] = {"8xy0", "_chip_8_ld_reg"},
+    [CHIP_8_OP_OR_REG] = {"8xy1", "_chip_8_or_reg"},
+    [CHIP_8_OP_AND_REG] = {"8xy2", "_chip_8_and_reg"},
+    [CHIP_8_OP_XOR_REG] = {"8xy3", "_chip_8_xor_reg"},
+    [CHIP_8_OP_ADD_REG] = {"8xy4", "_chip_8_add_reg"},
+    [CHIP_8_OP_SUB_REG] = {"8xy5", "_chip_8_sub_reg"},
+    [CHIP_8_OP_SHR] = {"8xy6", "_chip_8_shr"},
+    [CHIP_8_OP_SUBN_REG] = {"8xy7", "_chip_8_subn_reg"},
+    [CHIP_8_OP_SHL] = {"8xyE", "_chip_8_shl"},
+    [CHIP_8_OP_SNE_REG] = {"9xy0", "_chip_8_sne_reg"},
+    [CHIP_8_OP_LD_ADDR] = {"Annn", "_chip_8_ld_addr"},
+    [CHIP_8_OP_JP_REL] = {"Bnnn", "_chip_8_jp_rel"},
+    [CHIP_8_OP_RND] = {"Cxkk", "_chip_8_rnd"},
+    [CHIP_8_OP_DRW] = {"Dxyn", "_chip_8_drw"},
+    [CHIP_8_OP_SKP] = {"Ex9E", "_chip_8_skp"},
+    [CHIP_8_OP_SKNP] = {"ExA1", "_chip_8_sknp"},
+    [CHIP_8_OP_LD_DT] = {"Fx07", "_chip_8_ld_dt"},
+    [CHIP_8_OP_LD_K] = {"Fx0A", "_chip_8_ld_k"},
+    [CHIP_8_OP_LD_DT_REG] = {"Fx15", "_chip_8_ld_dt_reg"},
+    [CHIP_8_OP_LD_ST_REG] = {"Fx18", "_chip_8_ld_st_reg"},
+    [CHIP_8_OP_ADD_I_REG] = {"Fx1E", "_chip_8_add_i_reg"},
+    [CHIP_8_OP_LD_F_REG] = {"Fx29", "_chip_8_ld_f_reg"},
+    [CHIP_8_OP_LD_B_REG] = {"Fx33", "_chip_8_ld_b_reg"},
+    [CHIP_8_OP_LD_I_REG] = {"Fx55", "_chip_8_ld_i_reg"},
+    [CHIP_8_OP_LD_REG_I] = {"Fx65", "_chip_8_ld_reg_i"},
+    [CHIP_8_OP_UNKNOWN] = {"????", "_chip_8_unknown"},
+};
+
+/**
+ * A backward 1nnn found by chip_8_profile_report_loops.
+ */
+typedef struct chip_8_profile_loop {
+    uint16_t start;
+    uint16_t end;
+    uint64_t iterations;
+    uint64_t weight;
+} chip_8_profile_loop;
+
+/**
+ * Measures the ticks a sample reads when the handler does nothing.
+ *
+ * The samples go to a profile of their own, allocated per call so that
+ * emulators on other threads can report at the same time.
+ *
+ * @return The overhead of a sample, or 0 if it could not be measured.
+ */
+static uint64_t _chip_8_profile_calibrate(void) {
+    chip_8_profile *scratch = malloc(sizeof(*scratch));
+    if (scratch == NULL) {
+        fprintf(stderr, "Failed to calibrate the profiler\n");
+        return 0;
+    }
+
+    uint64_t overhead = UINT64_MAX;
+
+    for (size_t batch = 0; batch < CALIBRATION_BATCHES; batch++) {
+        memset(scratch, 0, sizeof(*scratch));
+
+        for (size_t i = 0; i < CALIBRATION_ROUNDS; i++) {
+            _chip_8_profile_sample(scratch, CHIP_8_OP_UNKNOWN,
+                                   _chip_8_profile_clock());
+        }
+
+        uint64_t ticks = scratch->ticks[CHIP_8_OP_UNKNOWN] / CALIBRATION_ROUNDS;
+        if (ticks < overhead) {
+            overhead = ticks;
+        }
+    }
+
+    free(scratch);
+    return overhead;
+}
+
+static void _chip_8_profile_bucket(char *label, size_t size, size_t bucket) {
+    if (bucket == 0) {
+        snprintf(label, size, "0");
+    } else if (bucket == PROFILE_BUCKETS - 1) {
+        snprintf(label, size, "%llu+", 1ULL << (bucket - 1));
+    } else {
+        snprintf(label, size, "%llu-%llu", 1ULL << (bucket - 1),
+                 (1ULL << bucket) - 1);
+    }
+}
+
+static int _chip_8_profile_compare_loops(const void *a, const void *b) {
+    const chip_8_profile_loop *x = a;
+    const chip_8_profile_loop *y = b;
+    return (x->weight < y->weight) - (x->weight > y->weight);
+}
+
+/**
+ * Names what a loop does, judging by the instructions in its body.
+ *
+ * @param emu  The emulator structure.
+ * @param loop The loop.
+ * @return "halt", "wait" or "work".
+ */
+static const char *_chip_8_profile_loop_kind(const chip_8 *emu,
+                                             const chip_8_profile_loop *loop) {
+    if (loop->start == loop->end) {
+        return "halt";
+    }
+
+    size_t len = (loop->end - loop->start) / 2 + 1;
+    if (len > WAIT_LOOP_LEN) {
+        return "work";
+    }
+
+    for (size_t addr = loop->start; addr <= loop->end; addr += 2) {
+        switch (emu->_code[addr].op) {
+        case CHIP_8_OP_CLS:
+        case CHIP_8_OP_DRW:
+        case CHIP_8_OP_CALL:
+        case CHIP_8_OP_RET:
+        case CHIP_8_OP_LD_ST_REG:
+        case CHIP_8_OP_LD_B_REG:
+        case CHIP_8_OP_LD_I_REG:
+            return "work";
+        default:
+            break;
+        }
+    }
+
+    return "wait";
+}
+
+// log2(value) for value >= 1, interpolated linearly between powers of two.
+static double _chip_8_profile_log2(uint64_t value) {
+    unsigned bits = 0;
+    while (value >> (bits + 1)) {
+        bits++;
+    }
+    return bits + (double)value / (1ULL << bits) - 1;
+}
+
+void chip_8_profile_reset(chip_8 *emu) {
+    memset(&emu->_profile, 0, sizeof(emu->_profile));
+    emu->_profile.countdown = PROFILE_PERIOD;
+    emu->_profile.rng = 0x9E3779B9;
+}
+
+void chip_8_profile_report(const chip_8 *emu, FILE *out) {
+    const chip_8_profile *profile = &emu->_profile;
+
+    uint64_t overhead = _chip_8_profile_calibrate();
+
+    // Handler time of every class, scaled up from the timed executions
+    // without their clock reads, and the classes that ran, hottest first.
+    double mean[CHIP_8_OP_COUNT];
+    double time[CHIP_8_OP_COUNT];
+    size_t order[CHIP_8_OP_COUNT];
+    size_t classes = 0;
+    uint64_t executions = 0, samples = 0, sampled = 0;
+    double handlers = 0, unsampled = 0;
+
+    for (size_t op = 0; op < CHIP_8_OP_COUNT; op++) {
+        mean[op] = 0;
+        if (profile->samples[op] > 0) {
+            mean[op] = (double)profile->ticks[op] / profile->samples[op] -
+                       overhead;
+            if (mean[op] < 0) {
+                mean[op] = 0;
+            }
+        }
+        time[op] = mean[op] * profile->count[op];
+        unsampled += mean[op] * (profile->count[op] - profile->samples[op]);
+
+        executions += profile->count[op];
+        samples += profile->samples[op];
+        sampled += profile->ticks[op];
+        handlers += time[op];
+
+        if (profile->count[op] == 0) {
+            continue;
+        }
+
+        size_t i = classes++;
+        for (; i > 0 && time[order[i - 1]] < time[op]; i--) {
+            order[i] = order[i - 1];
+        }
+        order[i] = op;
+    }
+
+    // Whatever run_until spent outside handlers went into fetching,
+    // dispatching, the timers and waiting loops, or was taken away by the
+    // host.
+    double outside = profile->run_ticks - sampled - unsampled;
+    if (outside < 0) {
+        outside = 0;
+    }
+
+    double total = handlers + outside;
+    if (total == 0) {
+        total = 1;
+    }
+
+    fprintf(out,
+            "Profile of %llu instructions, %llu timed, in %s with %llu per "
+            "clock read subtracted\n\n",
+            (unsigned long long)executions, (unsigned long long)samples,
+            PROFILE_UNIT, (unsigned long long)overhead);
+    fprintf(out, "%-6s %-18s %12s %6s %14s %6s %8s\n", "class", "handler",
+            "count", "insns", "time", "share", "mean");
+
+    for (size_t i = 0; i < classes; i++) {
+        size_t op = order[i];
+        fprintf(out, "%-6s %-18s %12llu %5.1f%% %14.0f %5.1f%% %8.1f\n",
+                chip_8_profile_names[op].pattern,
+                chip_8_profile_names[op].handler,
+                (unsigned long long)profile->count[op],
+                100.0 * profile->count[op] / executions, time[op],
+                100.0 * time[op] / total, mean[op]);
+    }
+
+    uint64_t fetched = profile->run_cycles - profile->skipped;
+    if (fetched > 0) {
+        fprintf(out, "%-6s %-18s %12llu %6s %14.0f %5.1f%% %8.1f\n", "",
+                "fetch and dispatch", (unsigned long long)fetched, "",
+                outside, 100.0 * outside / total, outside / fetched);
+    }
+
+    if (profile->skipped > 0) {
+        fprintf(out, "\n%llu cycles fast-forwarded in waiting loops\n",
+                (unsigned long long)profile->skipped);
+    }
+
+    fprintf(out, "\n%s per timed execution, including one clock read:\n",
+            PROFILE_UNIT);
+
+    for (size_t i = 0; i < classes; i++) {
+        size_t op = order[i];
+        fprintf(out, "%-6s", chip_8_profile_names[op].pattern);
+
+        uint64_t timed = 0;
+        for (size_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            timed += profile->hist[op][bucket];
+        }
+
+        if (timed == 0) {
+            fprintf(out, " not timed\n");
+            continue;
+        }
+
+        // Buckets under 0.1% are left out, except for the slowest one.
+        size_t slowest = 0;
+        for (size_t bucket = 0; bucket < PROFILE_BUCKETS; bucket++) {
+            uint64_t count = profile->hist[op][bucket];
+            if (count == 0) {
+                continue;
+            }
+            slowest = bucket;
+
+            if (count * 1000 >= timed) {
+                char label[48];
+                _chip_8_profile_bucket(label, sizeof(label), bucket);
+                fprintf(out, " %s:%.1f%%", label, 100.0 * count / timed);
+            }
+        }
+
+        char label[48];
+        _chip_8_profile_bucket(label, sizeof(label), slowest);
+        fprintf(out, "  slowest %s\n", label);
+    }
+
+    fputc('\n', out);
+    chip_8_profile_report_loops(emu, PROFILE_TOP_LOOPS, out);
+}
+
+void chip_8_profile_report_loops(const chip_8 *emu, size_t top, FILE *out) {
+    const chip_8_profile *profile = &emu->_profile;
+    size_t count = 0;
+    uint64_t executions = 0;
+
+    // At most one loop ends at every address.
+    chip_8_profile_loop *loops = malloc(MEMORY_SIZE * sizeof(*loops));
+    if (loops == NULL) {
+        fprintf(stderr, "Failed to list the loops\n");
+        return;
+    }
+
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        executions += profile->heat[addr];
+
+        const chip_8_insn *insn = &emu->_code[addr];
+        if (insn->op != CHIP_8_OP_JP || insn->nnn > addr ||
+            profile->heat[addr] == 0) {
+            continue;
+        }
+
+        chip_8_profile_loop *loop = &loops[count++];
+        loop->start = insn->nnn;
+        loop->end = addr;
+        loop->iterations = profile->heat[addr];
+        loop->weight = 0;
+
+        for (size_t body = loop->start; body <= loop->end; body++) {
+            loop->weight += profile->heat[body];
+        }
+    }
+
+    qsort(loops, count, sizeof(loops[0]), _chip_8_profile_compare_loops);
+
+    if (executions == 0) {
+        executions = 1;
+    }
+
+    fprintf(out, "%-11s %5s %12s %14s %6s  %s\n", "loop", "insns",
+            "iterations", "executed", "share", "kind");
+
+    for (size_t i = 0; i < count && i < top; i++) {
+        const chip_8_profile_loop *loop = &loops[i];
+        fprintf(out, "0x%03x-0x%03x %5u %12llu %14llu %5.1f%%  %s\n",
+                loop->start, loop->end, (loop->end - loop->start) / 2 + 1,
+                (unsigned long long)loop->iterations,
+                (unsigned long long)loop->weight,
+                100.0 * loop->weight / executions,
+                _chip_8_profile_loop_kind(emu, loop));
+    }
+
+    free(loops);
+}
+
+bool chip_8_profile_write_csv(const chip_8 *emu, const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to write heatmap: %s\n", path);
+        return false;
+    }
+
+    fprintf(file, "address,opcode,executions\n");
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        fprintf(file, "0x%03zx,%04x,%llu\n", addr, emu->_code[addr].opcode,
+                (unsigned long long)emu->_profile.heat[addr]);
+    }
+
+    return fclose(file) == 0;
+}
+
+bool chip_8_profile_write_ppm(const chip_8 *emu, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to write heatmap: %s\n", path);
+        return false;
+    }
+
+    uint64_t hottest = 0;
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        if (emu->_profile.heat[addr] > hottest) {
+            hottest = emu->_profile.heat[addr];
+        }
+    }
+    double scale = _chip_8_profile_log2(hottest + 1);
+
+    fprintf(file, "P6\n%d %d\n255\n", HEATMAP_WIDTH, HEATMAP_HEIGHT);
+
+    for (size_t addr = 0; addr < MEMORY_SIZE; addr++) {
+        uint64_t heat = emu->_profile.heat[addr];
+        uint8_t pixel[3] = {0, 0, 0};
+
+        if (heat > 0) {
+            // Red, then yellow, then white as the count grows.
+            double t = 3 * _chip_8_profile_log2(heat + 1) / scale;
+            for (size_t c = 0; c < 3; c++) {
+                double level = t - c;
+                level = level < 0 ? 0 : level > 1 ? 1 : level;
+                pixel[c] = level * 255;
+            }
+        }
+
+        fwrite(pixel, 1, sizeof(pixel), file);
+    }
+
+    return fclose(file) == 0;
+}
+#else
+void chip_8_profile_reset(chip_8 *emu) {}
+
+void chip_8_profile_report(const chip_8 *emu, FILE *out) {
+    fprintf(out, "Built without PROFILE=1, no profile was collected\n");
+}
+
+void chip_8_profile_report_loops(const chip_8 *emu, size_t top, FILE *out) {
+    chip_8_profile_report(emu, out);
+}
+
+bool chip_8_profile_write_csv(const chip_8 *emu, const char *path) {
+    chip_8_profile_report(emu, stderr);
+    return false;
+}
+
+bool chip_8_profile_write_ppm(const chip_8 *emu, const char *path) {
+    chip_8_profile_report(emu, stderr);
+    return false;
+}
+#endif
@@ -0,0 +1,145 @@
+#ifndef CHIP_8_PROFILE_H
+#define CHIP_8_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "chip_8.h"
+
+#ifdef CHIP_8_PROFILE
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+
+#define PROFILE_UNIT "TSC ticks"
+#else
+#include <time.h>
+
+#define PROFILE_UNIT "ns"
+#endif
+
+/**
+ * Reads the host clock: the time stamp counter on x86, a monotonic
+ * nanosecond clock elsewhere.
+ *
+ * @return The current time in PROFILE_UNIT.
+ */
+static inline uint64_t _chip_8_profile_clock(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+#endif
+}
+
+/**
+ * Charges a timed execution of an instruction class with the time since
+ * start and picks the next execution to time.
+ *
+ * @param profile The profile to add to.
+ * @param op      The instruction class.
+ * @param start   The clock when the handler was entered.
+ */
+static inline void _chip_8_profile_sample(chip_8_profile *profile,
+                                          chip_8_op op, uint64_t start) {
+    uint64_t ticks = _chip_8_profile_clock() - start;
+    unsigned bucket = 0;
+
+    while (bucket < PROFILE_BUCKETS - 1 && ticks >> bucket) {
+        bucket++;
+    }
+
+    if (ticks < PROFILE_INTERRUPTED) {
+        profile->samples[op]++;
+        profile->ticks[op] += ticks;
+    }
+    profile->hist[op][bucket]++;
+
+    profile->rng ^= profile->rng << 13;
+    profile->rng ^= profile->rng >> 17;
+    profile->rng ^= profile->rng << 5;
+    profile->countdown = 1 + (profile->rng & (2 * PROFILE_PERIOD - 1));
+}
+
+// Runs stmt as an execution of instruction class op, timing it if it is the
+// one picked.
+#define PROFILE(emu, op, stmt)                                                 \
+    do {                                                                       \
+        chip_8_profile *profile = &(emu)->_profile;                            \
+        profile->count[op]++;                                                  \
+        if (--profile->countdown != 0) {                                       \
+            stmt;                                                              \
+            break;                                                             \
+        }                                                                      \
+        uint64_t profile_start = _chip_8_profile_clock();                      \
+        stmt;                                                                  \
+        _chip_8_profile_sample(profile, op, profile_start);                    \
+    } while (0)
+
+// Counts an instruction fetched from addr.
+#define PROFILE_HEAT(emu, addr) ((emu)->_profile.heat[(addr) & ADDR_MASK]++)
+#else
+#define PROFILE(emu, op, stmt) stmt
+#define PROFILE_HEAT(emu, addr) ((void)0)
+#endif
+
+/**
+ * Clears the profile of the emulator. chip_8_init does this as well.
+ *
+ * @param emu The emulator structure.
+ */
+void chip_8_profile_reset(chip_8 *emu);
+
+/**
+ * Prints the profile of the emulator, hottest instruction class first.
+ *
+ * For every class the report lists its handler, how often it ran and the
+ * host time it took, estimated from the timed executions, then a histogram
+ * of their times. The overhead of reading the clock is measured and
+ * subtracted. The PROFILE_TOP_LOOPS hottest loops follow.
+ *
+ * @param emu The emulator structure.
+ * @param out The stream to print to.
+ */
+void chip_8_profile_report(const chip_8 *emu, FILE *out);
+
+/**
+ * Prints the hottest loops of the program.
+ *
+ * A loop is a 1nnn that jumped back to nnn at or below its own address. Its
+ * weight is the number of instructions executed from nnn to the jump, which
+ * includes the loops nested in it. A loop that jumps to itself halts, and a
+ * loop of at most four instructions without side effects on the screen,
+ * memory, stack or sound is waiting for a timer or a key.
+ *
+ * @param emu The emulator structure.
+ * @param top The number of loops to print.
+ * @param out The stream to print to.
+ */
+void chip_8_profile_report_loops(const chip_8 *emu, size_t top, FILE *out);
+
+/**
+ * Writes the number of instructions fetched from every address as CSV, with
+ * the address, the opcode there and the count on each line.
+ *
+ * @param emu  The emulator structure.
+ * @param path The path of the file to write.
+ * @return True if the file was written, False otherwise.
+ */
+bool chip_8_profile_write_csv(const chip_8 *emu, const char *path);
+
+/**
+ * Writes the fetch counts as a 64x64 binary PPM image, one pixel per address
+ * in rows of 64 bytes. Addresses never fetched from are black and the others
+ * go from dark red through yellow to white on a logarithmic scale.
+ *
+ * @param emu  The emulator structure.
+ * @param path The path of the file to write.
+ * @return True if the file was written, False otherwise.
+ */
+bool chip_8_profile_write_ppm(const chip_8 *emu, const char *path);
+
+#endif // CHIP_8_PROFILE_H
@@ -0,0 +1,336 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "chip_8_rewind.h"
+
+// Zero runs shorter than this are kept inside a literal run; a separate run
+// would cost more than the bytes it skips.
+#define MIN_ZERO_RUN 3
+
+static uint8_t *capture_field(uint8_t *out, const void *field, size_t size) {
+    memcpy(out, field, size);
+    return out + size;
+}
+
+static const uint8_t *restore_field(const uint8_t *in, void *field,
+                                    size_t size) {
+    memcpy(field, in, size);
+    return in + size;
+}
+
+/**
+ * Copies the state a snapshot covers into a raw image.
+ *
+ * The layout is only ever read back by restore on the same host, so fields
+ * are copied in their native representation.
+ *
+ * @param emu   The emulator structure.
+ * @param image REWIND_IMAGE_SIZE bytes to write into.
+ */
+static void capture(const chip_8 *emu, uint8_t *image) {
+    uint8_t *out = image;
+
+    out = capture_field(out, emu->_memory, MEMORY_SIZE);
+    out = capture_field(out, emu->_V, REGISTERS);
+    out = capture_field(out, &emu->_I, 2);
+    out = capture_field(out, &emu->_pc, 2);
+    out = capture_field(out, &emu->_opcode, 2);
+    *out++ = emu->_sp;
+    out = capture_field(out, emu->_stack, STACK_SIZE * 2);
+    *out++ = emu->_delay_timer;
+    *out++ = emu->_sound_timer;
+    out = capture_field(out, &emu->_cycles, 8);
+    out = capture_field(out, &emu->_ips, 4);
+    out = capture_field(out, &emu->_timer_phase, 4);
+    out = capture_field(out, &emu->_quirks, 4);
+    out = capture_field(out, &emu->_rng, 8);
+    capture_field(out, emu->_framebuffer, FB_HEIGHT * 8);
+}
+
+/**
+ * Restores the emulator from a raw image written by capture.
+ *
+ * @param emu   The emulator structure.
+ * @param image The image to restore.
+ */
+static void restore(chip_8 *emu, const uint8_t *image) {
+    const uint8_t *in = image;
+
+    _chip_8_write_memory(emu, in);
+    in += MEMORY_SIZE;
+
+    in = restore_field(in, emu->_V, REGISTERS);
+    in = restore_field(in, &emu->_I, 2);
+    in = restore_field(in, &emu->_pc, 2);
+    in = restore_field(in, &emu->_opcode, 2);
+    emu->_sp = *in++;
+    in = restore_field(in, emu->_stack, STACK_SIZE * 2);
+    emu->_delay_timer = *in++;
+    emu->_sound_timer = *in++;
+    in = restore_field(in, &emu->_cycles, 8);
+    in = restore_field(in, &emu->_ips, 4);
+    in = restore_field(in, &emu->_timer_phase, 4);
+    in = restore_field(in, &emu->_quirks, 4);
+    in = restore_field(in, &emu->_rng, 8);
+    restore_field(in, emu->_framebuffer, FB_HEIGHT * 8);
+
+    emu->_dirty_rows = UINT32_MAX;
+    emu->_fault = CHIP_8_FAULT_NONE;
+}
+
+static size_t put_varint(uint8_t *out, size_t value) {
+    size_t len = 0;
+    while (value >= 0x80) {
+        out[len++] = value | 0x80;
+        value >>= 7;
+    }
+    out[len++] = value;
+    return len;
+}
+
+static size_t get_varint(const uint8_t *in, size_t *pos) {
+    size_t value = 0;
+    for (size_t shift = 0;; shift += 7) {
+        uint8_t byte = in[(*pos)++];
+        value |= (size_t)(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+/**
+ * Run-length encodes the XOR of an image with a base image.
+ *
+ * The record is a sequence of (zero run, literal length, literal bytes)
+ * triples with varint lengths; trailing zeros are left out.
+ *
+ * @param image The image to encode.
+ * @param base  The image to XOR against, or NULL for a keyframe.
+ * @param out   At least REWIND_MAX_RECORD bytes for the record.
+ * @return The size of the record.
+ */
+static size_t encode(const uint8_t *image, const uint8_t *base,
+                     uint8_t *out) {
+    static const uint8_t zeros[REWIND_IMAGE_SIZE];
+    if (base == NULL) {
+        base = zeros;
+    }
+
+    size_t len = 0;
+    size_t i = 0;
+
+    while (i < REWIND_IMAGE_SIZE) {
+        size_t start = i;
+        while (i < REWIND_IMAGE_SIZE && image[i] == base[i]) {
+            i++;
+        }
+        if (i == REWIND_IMAGE_SIZE) {
+            break;
+        }
+
+        size_t end = i;
+        while (end < REWIND_IMAGE_SIZE) {
+            if (image[end] != base[end]) {
+                end++;
+                continue;
+            }
+
+            size_t gap = 0;
+            while (end + gap < REWIND_IMAGE_SIZE && gap < MIN_ZERO_RUN &&
+                   image[end + gap] == base[end + gap]) {
+                gap++;
+            }
+            if (gap == MIN_ZERO_RUN || end + gap == REWIND_IMAGE_SIZE) {
+                break;
+            }
+            end += gap;
+        }
+
+        len += put_varint(out + len, i - start);
+        len += put_varint(out + len, end - i);
+        for (; i < end; i++) {
+            out[len++] = image[i] ^ base[i];
+        }
+    }
+
+    return len;
+}
+
+/**
+ * XORs a record written by encode into an image.
+ *
+ * @param record The record.
+ * @param size   The size of the record.
+ * @param image  The image, holding the base of the record.
+ */
+static void decode(const uint8_t *record, size_t size, uint8_t *image) {
+    size_t pos = 0;
+    size_t i = 0;
+
+    while (pos < size) {
+        i += get_varint(record, &pos);
+        size_t len = get_varint(record, &pos);
+        for (size_t end = i + len; i < end; i++) {
+            image[i] ^= record[pos++];
+        }
+    }
+}
+
+static chip_8_rewind_entry *entry(const chip_8_rewind *rewind,
+                                  uint64_t seq) {
+    return &rewind->entries[seq % REWIND_MAX_FRAMES];
+}
+
+/**
+ * Drops the oldest keyframe together with the deltas against it.
+ *
+ * @param rewind The rewind buffer.
+ */
+static void drop_oldest(chip_8_rewind *rewind) {
+    uint64_t keyframe = entry(rewind, rewind->first)->keyframe;
+
+    while (rewind->first < rewind->next &&
+           entry(rewind, rewind->first)->keyframe == keyframe) {
+        rewind->first++;
+    }
+
+    if (rewind->has_keyframe && rewind->keyframe == keyframe) {
+        rewind->has_keyframe = false;
+    }
+}
+
+/**
+ * Finds room for a record in the pool, dropping the oldest frames until it
+ * fits.
+ *
+ * @param rewind The rewind buffer.
+ * @param size   The size of the record.
+ * @return The offset of the record.
+ */
+static size_t allocate(chip_8_rewind *rewind, size_t size) {
+    if (rewind->head + size > rewind->capacity) {
+        // Skip the tail of the pool. Whatever still lives there is older
+        // than everything at its start.
+        while (rewind->first < rewind->next &&
+               entry(rewind, rewind->first)->offset >= rewind->head) {
+            drop_oldest(rewind);
+        }
+        rewind->head = 0;
+    }
+
+    while (rewind->first < rewind->next) {
+        const chip_8_rewind_entry *oldest = entry(rewind, rewind->first);
+        if (oldest->offset >= rewind->head + size ||
+            oldest->offset + oldest->size <= rewind->head) {
+            break;
+        }
+        drop_oldest(rewind);
+    }
+
+    return rewind->head;
+}
+
+bool chip_8_rewind_init(chip_8_rewind *rewind, size_t capacity) {
+    if (capacity < REWIND_MAX_RECORD) {
+        fprintf(stderr, "Rewind buffer too small: %zu bytes\n", capacity);
+        return false;
+    }
+
+    rewind->pool = malloc(capacity);
+    rewind->entries = malloc(REWIND_MAX_FRAMES * sizeof(chip_8_rewind_entry));
+    if (rewind->pool == NULL || rewind->entries == NULL) {
+        fprintf(stderr, "Failed to allocate the rewind buffer\n");
+        chip_8_rewind_free(rewind);
+        return false;
+    }
+
+    rewind->capacity = capacity;
+    rewind->head = 0;
+    rewind->first = 0;
+    rewind->next = 0;
+    rewind->keyframe = 0;
+    rewind->has_keyframe = false;
+
+    return true;
+}
+
+void chip_8_rewind_free(chip_8_rewind *rewind) {
+    free(rewind->pool);
+    free(rewind->entries);
+    rewind->pool = NULL;
+    rewind->entries = NULL;
+}
+
+void chip_8_rewind_push(chip_8_rewind *rewind, const chip_8 *emu) {
+    capture(emu, rewind->image);
+
+    if (rewind->next - rewind->first == REWIND_MAX_FRAMES) {
+        drop_oldest(rewind);
+    }
+
+    bool keyframe;
+    size_t size, offset;
+
+    // Making room may drop the keyframe a delta was taken against, in which
+    // case the frame becomes a keyframe itself.
+    do {
+        keyframe = !rewind->has_keyframe ||
+                   rewind->next - rewind->keyframe >= REWIND_KEYFRAME_INTERVAL;
+        size = encode(rewind->image, keyframe ? NULL : rewind->base,
+                      rewind->record);
+        offset = allocate(rewind, size);
+    } while (!keyframe && !rewind->has_keyframe);
+
+    memcpy(rewind->pool + offset, rewind->record, size);
+    rewind->head = offset + size;
+
+    if (keyframe) {
+        rewind->keyframe = rewind->next;
+        rewind->has_keyframe = true;
+        memcpy(rewind->base, rewind->image, REWIND_IMAGE_SIZE);
+    }
+
+    *entry(rewind, rewind->next) =
+        (chip_8_rewind_entry){offset, size, rewind->keyframe};
+    rewind->next++;
+}
+
+bool chip_8_rewind_pop(chip_8_rewind *rewind, chip_8 *emu) {
+    if (rewind->first == rewind->next) {
+        return false;
+    }
+
+    uint64_t seq = rewind->next - 1;
+    const chip_8_rewind_entry *newest = entry(rewind, seq);
+
+    // The base image is decoded again only when the keyframe changes.
+    if (!rewind->has_keyframe || rewind->keyframe != newest->keyframe) {
+        const chip_8_rewind_entry *key = entry(rewind, newest->keyframe);
+        memset(rewind->base, 0, REWIND_IMAGE_SIZE);
+        decode(rewind->pool + key->offset, key->size, rewind->base);
+        rewind->keyframe = newest->keyframe;
+        rewind->has_keyframe = true;
+    }
+
+    memcpy(rewind->image, rewind->base, REWIND_IMAGE_SIZE);
+    if (newest->keyframe != seq) {
+        decode(rewind->pool + newest->offset, newest->size, rewind->image);
+    }
+
+    restore(emu, rewind->image);
+
+    rewind->head = newest->offset;
+    rewind->next = seq;
+
+    // A popped keyframe can no longer serve as the base of new deltas.
+    if (rewind->keyframe == seq) {
+        rewind->has_keyframe = false;
+    }
+
+    return true;
+}
+
+size_t chip_8_rewind_frames(const chip_8_rewind *rewind) {
+    return rewind->next - rewind->first;
+}
@@ -0,0 +1,109 @@
+#ifndef CHIP_8_REWIND_H
+#define CHIP_8_REWIND_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip_8.h"
+
+// Ten minutes of frames at 60 Hz, and one keyframe per second.
+#define REWIND_MAX_FRAMES        (60 * 60 * 10)
+#define REWIND_KEYFRAME_INTERVAL 60
+
+// Raw image of the state a snapshot covers: memory, V, I, pc, opcode, sp,
+// stack, timers, cycle count, instructions per second, timer phase, quirks,
+// RNG state and framebuffer.
+#define REWIND_IMAGE_SIZE                                                      \
+    (MEMORY_SIZE + REGISTERS + 2 + 2 + 2 + 1 + STACK_SIZE * 2 + 1 + 1 + 8 +   \
+     4 + 4 + 4 + 8 + FB_HEIGHT * 8)
+
+// Upper bound of an encoded snapshot.
+#define REWIND_MAX_RECORD (REWIND_IMAGE_SIZE * 2 + 16)
+
+/**
+ * A snapshot in the pool.
+ *
+ * keyframe is the sequence number of the keyframe the snapshot is an XOR
+ * delta against, or its own sequence number for a keyframe.
+ */
+typedef struct chip_8_rewind_entry {
+    uint32_t offset;
+    uint32_t size;
+    uint64_t keyframe;
+} chip_8_rewind_entry;
+
+/**
+ * A ring buffer of per-frame snapshots for stepping a game backwards.
+ *
+ * Every REWIND_KEYFRAME_INTERVAL frames a keyframe is stored, and the frames
+ * in between as XOR deltas against it, so any frame decodes from two
+ * records. Both are run-length encoded, which leaves a few dozen bytes for
+ * a typical frame. Records are appended to a circular byte pool and the
+ * oldest keyframe is dropped together with its deltas when space runs out.
+ */
+typedef struct chip_8_rewind {
+    uint8_t *pool;
+    size_t capacity;
+    size_t head;
+
+    // Snapshots first to next - 1, indexed by sequence number modulo
+    // REWIND_MAX_FRAMES.
+    chip_8_rewind_entry *entries;
+    uint64_t first;
+    uint64_t next;
+
+    // The keyframe new deltas are taken against, and its image.
+    uint64_t keyframe;
+    bool has_keyframe;
+    uint8_t base[REWIND_IMAGE_SIZE];
+
+    uint8_t image[REWIND_IMAGE_SIZE];
+    uint8_t record[REWIND_MAX_RECORD];
+} chip_8_rewind;
+
+/**
+ * Initializes an empty rewind buffer.
+ *
+ * @param rewind   The rewind buffer.
+ * @param capacity The size of the snapshot pool in bytes, at least
+ *                 REWIND_MAX_RECORD.
+ * @return True if the buffer could be allocated, False otherwise.
+ */
+bool chip_8_rewind_init(chip_8_rewind *rewind, size_t capacity);
+
+/**
+ * Releases the memory of a rewind buffer.
+ *
+ * @param rewind The rewind buffer.
+ */
+void chip_8_rewind_free(chip_8_rewind *rewind);
+
+/**
+ * Stores a snapshot of the emulator as the newest frame.
+ *
+ * @param rewind The rewind buffer.
+ * @param emu    The emulator structure.
+ */
+void chip_8_rewind_push(chip_8_rewind *rewind, const chip_8 *emu);
+
+/**
+ * Restores the emulator to the newest frame and removes it from the buffer.
+ *
+ * Keys are not part of a snapshot and keep their current state.
+ *
+ * @param rewind The rewind buffer.
+ * @param emu    The emulator structure.
+ * @return True if a frame was restored, False if the buffer is empty.
+ */
+bool chip_8_rewind_pop(chip_8_rewind *rewind, chip_8 *emu);
+
+/**
+ * Returns the number of frames in the buffer.
+ *
+ * @param rewind The rewind buffer.
+ * @return The number of frames that can be rewound.
+ */
+size_t chip_8_rewind_frames(const chip_8_rewind *rewind);
+
+#endif // CHIP_8_REWIND_H
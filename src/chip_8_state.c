@@ -0,0 +1,248 @@
+#include <string.h>
+
+#include "chip_8_state.h"
+
+/**
+ * A bounds-checked cursor over a snapshot being read. Reading past the end
+ * yields zeros and clears ok.
+ */
+typedef struct state_reader {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;
+    bool ok;
+} state_reader;
+
+static uint8_t *put_u8(uint8_t *out, uint8_t value) {
+    *out++ = value;
+    return out;
+}
+
+static uint8_t *put_u16(uint8_t *out, uint16_t value) {
+    *out++ = value;
+    *out++ = value >> 8;
+    return out;
+}
+
+static uint8_t *put_u32(uint8_t *out, uint32_t value) {
+    out = put_u16(out, value);
+    return put_u16(out, value >> 16);
+}
+
+static uint8_t *put_u64(uint8_t *out, uint64_t value) {
+    out = put_u32(out, value);
+    return put_u32(out, value >> 32);
+}
+
+static const uint8_t *get_bytes(state_reader *in, size_t len) {
+    if (!in->ok || in->size - in->pos < len) {
+        in->ok = false;
+        return NULL;
+    }
+
+    const uint8_t *bytes = in->data + in->pos;
+    in->pos += len;
+    return bytes;
+}
+
+static uint8_t get_u8(state_reader *in) {
+    const uint8_t *bytes = get_bytes(in, 1);
+    return bytes != NULL ? bytes[0] : 0;
+}
+
+static uint16_t get_u16(state_reader *in) {
+    const uint8_t *bytes = get_bytes(in, 2);
+    return bytes != NULL ? bytes[0] | bytes[1] << 8 : 0;
+}
+
+static uint32_t get_u32(state_reader *in) {
+    uint32_t low = get_u16(in);
+    return low | (uint32_t)get_u16(in) << 16;
+}
+
+static uint64_t get_u64(state_reader *in) {
+    uint64_t low = get_u32(in);
+    return low | (uint64_t)get_u32(in) << 32;
+}
+
+size_t chip_8_save_state(const chip_8 *emu, uint8_t *buffer, size_t size) {
+    // Only the non-zero span of memory is stored.
+    size_t start = 0;
+    size_t end = MEMORY_SIZE;
+    while (start < end && emu->_memory[start] == 0) {
+        start++;
+    }
+    while (end > start && emu->_memory[end - 1] == 0) {
+        end--;
+    }
+
+    size_t sp = emu->_sp < STACK_SIZE ? emu->_sp : STACK_SIZE;
+    size_t total = STATE_FIXED_SIZE + (end - start) + sp * 2;
+    if (size < total) {
+        return 0;
+    }
+
+    uint8_t *out = buffer;
+
+    memcpy(out, STATE_MAGIC, 4);
+    out += 4;
+    out = put_u16(out, STATE_VERSION);
+
+    out = put_u16(out, start);
+    out = put_u16(out, end);
+    memcpy(out, emu->_memory + start, end - start);
+    out += end - start;
+
+    memcpy(out, emu->_V, REGISTERS);
+    out += REGISTERS;
+    out = put_u16(out, emu->_I);
+    out = put_u16(out, emu->_pc);
+    out = put_u16(out, emu->_opcode);
+    out = put_u8(out, sp);
+    for (size_t i = 0; i < sp; i++) {
+        out = put_u16(out, emu->_stack[i]);
+    }
+
+    out = put_u8(out, emu->_delay_timer);
+    out = put_u8(out, emu->_sound_timer);
+    out = put_u64(out, emu->_cycles);
+    out = put_u32(out, emu->_ips);
+    out = put_u32(out, emu->_timer_phase);
+    out = put_u32(out, emu->_quirks);
+    out = put_u64(out, emu->_rng);
+
+    uint16_t keys = 0;
+    for (size_t i = 0; i < KEYMAP_SIZE; i++) {
+        keys |= (emu->_keymap[i] != 0) << i;
+    }
+    out = put_u16(out, keys);
+
+    for (size_t row = 0; row < FB_HEIGHT; row++) {
+        out = put_u64(out, emu->_framebuffer[row]);
+    }
+
+    return out - buffer;
+}
+
+bool chip_8_load_state(chip_8 *emu, const uint8_t *buffer, size_t size) {
+    state_reader in = {buffer, size, 0, true};
+
+    const uint8_t *magic = get_bytes(&in, 4);
+    if (magic == NULL || memcmp(magic, STATE_MAGIC, 4) != 0) {
+        fprintf(stderr, "Not a CHIP-8 state snapshot\n");
+        return false;
+    }
+
+    uint16_t version = get_u16(&in);
+    if (!in.ok) {
+        fprintf(stderr, "Corrupt state snapshot\n");
+        return false;
+    }
+    if (version != STATE_VERSION) {
+        fprintf(stderr, "Unsupported state version: %d\n", version);
+        return false;
+    }
+
+    // Everything is read and validated before the emulator is touched.
+    uint16_t start = get_u16(&in);
+    uint16_t end = get_u16(&in);
+    const uint8_t *memory = NULL;
+    if (start <= end && end <= MEMORY_SIZE) {
+        memory = get_bytes(&in, end - start);
+    }
+
+    const uint8_t *V = get_bytes(&in, REGISTERS);
+    uint16_t I = get_u16(&in);
+    uint16_t pc = get_u16(&in);
+    uint16_t opcode = get_u16(&in);
+
+    uint8_t sp = get_u8(&in);
+    uint16_t stack[STACK_SIZE] = {0};
+    for (size_t i = 0; i < sp && i < STACK_SIZE; i++) {
+        stack[i] = get_u16(&in);
+    }
+
+    uint8_t delay_timer = get_u8(&in);
+    uint8_t sound_timer = get_u8(&in);
+    uint64_t cycles = get_u64(&in);
+    uint32_t ips = get_u32(&in);
+    uint32_t timer_phase = get_u32(&in);
+    uint32_t quirks = get_u32(&in);
+    uint64_t rng = get_u64(&in);
+    uint16_t keys = get_u16(&in);
+
+    uint64_t framebuffer[FB_HEIGHT];
+    for (size_t row = 0; row < FB_HEIGHT; row++) {
+        framebuffer[row] = get_u64(&in);
+    }
+
+    if (memory == NULL || !in.ok || in.pos != size || sp > STACK_SIZE ||
+        ips < TIMER_HZ || timer_phase >= ips || rng == 0) {
+        fprintf(stderr, "Corrupt state snapshot\n");
+        return false;
+    }
+
+    uint8_t image[MEMORY_SIZE] = {0};
+    memcpy(image + start, memory, end - start);
+    _chip_8_write_memory(emu, image);
+
+    memcpy(emu->_V, V, REGISTERS);
+    emu->_I = I;
+    emu->_pc = pc;
+    emu->_opcode = opcode;
+    memcpy(emu->_stack, stack, sizeof(stack));
+    emu->_sp = sp;
+
+    emu->_delay_timer = delay_timer;
+    emu->_sound_timer = sound_timer;
+    emu->_cycles = cycles;
+    emu->_ips = ips;
+    emu->_timer_phase = timer_phase;
+    emu->_quirks = quirks;
+    emu->_rng = rng;
+    // A fault is raised again by the instruction that caused it.
+    emu->_fault = CHIP_8_FAULT_NONE;
+
+    for (size_t i = 0; i < KEYMAP_SIZE; i++) {
+        emu->_keymap[i] = (keys >> i) & 1;
+    }
+
+    memcpy(emu->_framebuffer, framebuffer, sizeof(framebuffer));
+    emu->_dirty_rows = UINT32_MAX;
+
+    return true;
+}
+
+bool chip_8_save_state_file(const chip_8 *emu, const char *path) {
+    uint8_t buffer[STATE_MAX_SIZE];
+    size_t size = chip_8_save_state(emu, buffer, sizeof(buffer));
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open state file: %s\n", path);
+        return false;
+    }
+
+    size_t written = fwrite(buffer, 1, size, file);
+    if (fclose(file) != 0 || written != size) {
+        fprintf(stderr, "Failed to write state file: %s\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool chip_8_load_state_file(chip_8 *emu, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open state file: %s\n", path);
+        return false;
+    }
+
+    // One byte of slack tells an oversized file from a maximal snapshot.
+    uint8_t buffer[STATE_MAX_SIZE + 1];
+    size_t size = fread(buffer, 1, sizeof(buffer), file);
+    fclose(file);
+
+    return chip_8_load_state(emu, buffer, size);
+}
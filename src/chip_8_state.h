@@ -0,0 +1,81 @@
+#ifndef CHIP_8_STATE_H
+#define CHIP_8_STATE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip_8.h"
+
+#define STATE_MAGIC   "C8ST"
+#define STATE_VERSION 3
+
+// Fixed part of a snapshot: header, registers, timers, clock, quirks, RNG,
+// keys and framebuffer. Memory and the stack are stored only as far as they
+// are used.
+#define STATE_FIXED_SIZE                                                       \
+    (4 + 2 + 2 + 2 + REGISTERS + 2 + 2 + 2 + 1 + 1 + 1 + 8 + 4 + 4 + 4 + 8 +  \
+     2 + FB_HEIGHT * 8)
+#define STATE_MAX_SIZE (STATE_FIXED_SIZE + MEMORY_SIZE + STACK_SIZE * 2)
+
+/**
+ * Snapshots of the emulator state.
+ *
+ * A snapshot is a versioned little-endian binary image:
+ *
+ *   "C8ST", version (u16)
+ *   first and one past the last non-zero memory address (u16 each),
+ *   the memory in between
+ *   V0-VF, I, pc, the current opcode, sp (u8), the stack up to sp (u16 each)
+ *   delay timer, sound timer (u8 each)
+ *   cycle count (u64), instructions per second, timer phase, quirks (u32 each)
+ *   random number generator state (u64)
+ *   pressed keys, one bit per key (u16)
+ *   framebuffer, one u64 per row
+ *
+ * Caches are not part of a snapshot; they are rebuilt on load for the
+ * memory that differs from what the emulator held before. Neither is the
+ * fault, since the faulting instruction raises it again.
+ */
+
+/**
+ * Writes a snapshot of the emulator into a buffer.
+ *
+ * @param emu    The emulator structure.
+ * @param buffer The buffer to write into.
+ * @param size   The size of the buffer, at most STATE_MAX_SIZE is needed.
+ * @return The size of the snapshot, or 0 if the buffer is too small.
+ */
+size_t chip_8_save_state(const chip_8 *emu, uint8_t *buffer, size_t size);
+
+/**
+ * Restores the emulator from a snapshot in a buffer.
+ *
+ * The emulator is left unchanged if the snapshot is invalid.
+ *
+ * @param emu    The emulator structure.
+ * @param buffer The snapshot.
+ * @param size   The size of the snapshot.
+ * @return True if the snapshot was restored, False otherwise.
+ */
+bool chip_8_load_state(chip_8 *emu, const uint8_t *buffer, size_t size);
+
+/**
+ * Writes a snapshot of the emulator to a file.
+ *
+ * @param emu  The emulator structure.
+ * @param path The path to the file.
+ * @return True if the snapshot was written, False otherwise.
+ */
+bool chip_8_save_state_file(const chip_8 *emu, const char *path);
+
+/**
+ * Restores the emulator from a snapshot file.
+ *
+ * @param emu  The emulator structure.
+ * @param path The path to the file.
+ * @return True if the snapshot was restored, False otherwise.
+ */
+bool chip_8_load_state_file(chip_8 *emu, const char *path);
+
+#endif // CHIP_8_STATE_H
@@ -0,0 +1,542 @@
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "chip_8.h"
+#include "job.h"
+
+#define DEFAULT_FRAMES 600
+#define ROM_EXTENSION  ".ch8"
+
+/**
+ * Settings shared by every job of a run. Read-only once the workers start.
+ */
+typedef struct fleet_config {
+    unsigned long long max_cycles;
+    unsigned long long max_frames;
+    unsigned long ips;
+    unsigned long long seed;
+    unsigned quirks;
+    job_engine engine;
+} fleet_config;
+
+/**
+ * A ROM to run with an optional input script. line receives the JSON result
+ * from whichever worker runs the job.
+ */
+typedef struct fleet_job {
+    char *rom;
+    char *script;
+    char *line;
+} fleet_job;
+
+/**
+ * The jobs a worker has yet to run, as indices into the job list.
+ *
+ * The owner takes jobs from the bottom and idle workers steal from the top,
+ * so the two ends only meet once the queue is nearly empty. Jobs take
+ * milliseconds or more, so a mutex per queue costs nothing measurable.
+ */
+typedef struct fleet_queue {
+    pthread_mutex_t lock;
+    size_t *jobs;
+    size_t top;
+    size_t bottom;
+} fleet_queue;
+
+struct fleet;
+
+/**
+ * A worker thread with its own emulator and script buffer.
+ */
+typedef struct fleet_worker {
+    pthread_t thread;
+    size_t id;
+    struct fleet *fleet;
+    fleet_queue queue;
+    chip_8 emu;
+    job_script script;
+} fleet_worker;
+
+typedef struct fleet {
+    const fleet_config *config;
+    fleet_job *jobs;
+    size_t job_count;
+    fleet_worker *workers;
+    size_t worker_count;
+} fleet;
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: ./chip8-fleet [-b | -J] [-c cycles | -f frames] [-i ips] "
+            "[-j threads] [-o output] [-r seed] [-w] "
+            "<rom-directory | manifest>\n");
+}
+
+static char *copy_string(const char *text) {
+    char *copy = malloc(strlen(text) + 1);
+    if (copy != NULL) {
+        strcpy(copy, text);
+    }
+    return copy;
+}
+
+/**
+ * Joins a directory and a path, unless the path is absolute.
+ *
+ * @param dir  The directory, or NULL for the working directory.
+ * @param path The path.
+ * @return A newly allocated path, or NULL if out of memory.
+ */
+static char *join_path(const char *dir, const char *path) {
+    if (dir == NULL || path[0] == '/') {
+        return copy_string(path);
+    }
+
+    size_t size = strlen(dir) + 1 + strlen(path) + 1;
+    char *joined = malloc(size);
+    if (joined != NULL) {
+        snprintf(joined, size, "%s/%s", dir, path);
+    }
+    return joined;
+}
+
+static bool add_job(fleet *fleet, size_t *capacity, char *rom, char *script) {
+    if (fleet->job_count == *capacity) {
+        size_t grown = *capacity > 0 ? *capacity * 2 : 64;
+        fleet_job *jobs = realloc(fleet->jobs, grown * sizeof(fleet_job));
+        if (jobs == NULL) {
+            return false;
+        }
+        fleet->jobs = jobs;
+        *capacity = grown;
+    }
+
+    fleet->jobs[fleet->job_count++] = (fleet_job){rom, script, NULL};
+    return true;
+}
+
+static int compare_jobs(const void *a, const void *b) {
+    return strcmp(((const fleet_job *)a)->rom, ((const fleet_job *)b)->rom);
+}
+
+/**
+ * Adds every ROM in a directory as a job without a script, in name order.
+ *
+ * @param fleet The fleet to add the jobs to.
+ * @param path  The path to the directory.
+ * @return True if the directory was read, False otherwise.
+ */
+static bool load_directory(fleet *fleet, const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "Failed to open ROM directory: %s\n", path);
+        return false;
+    }
+
+    size_t capacity = 0;
+    size_t extension = strlen(ROM_EXTENSION);
+    struct dirent *entry;
+
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len <= extension ||
+            strcmp(entry->d_name + len - extension, ROM_EXTENSION) != 0) {
+            continue;
+        }
+
+        char *rom = join_path(path, entry->d_name);
+        if (rom == NULL || !add_job(fleet, &capacity, rom, NULL)) {
+            fprintf(stderr, "Out of memory\n");
+            free(rom);
+            closedir(dir);
+            return false;
+        }
+    }
+
+    closedir(dir);
+
+    qsort(fleet->jobs, fleet->job_count, sizeof(fleet_job), compare_jobs);
+    return true;
+}
+
+/**
+ * Adds the jobs of a manifest.
+ *
+ * Every line holds the path to a ROM, optionally followed by the path to an
+ * input script, both relative to the manifest. Empty lines and lines
+ * starting with # are skipped.
+ *
+ * @param fleet The fleet to add the jobs to.
+ * @param path  The path to the manifest.
+ * @return True if the manifest was loaded, False otherwise.
+ */
+static bool load_manifest(fleet *fleet, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open manifest: %s\n", path);
+        return false;
+    }
+
+    char *dir = copy_string(path);
+    char *slash = dir != NULL ? strrchr(dir, '/') : NULL;
+    if (slash != NULL) {
+        *slash = '\0';
+    } else {
+        free(dir);
+        dir = NULL;
+    }
+
+    char line[1024];
+    size_t number = 0;
+    size_t capacity = 0;
+    bool ok = true;
+
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        number++;
+
+        char *rest = NULL;
+        const char *rom = strtok_r(line, " \t\r\n", &rest);
+        if (rom == NULL || rom[0] == '#') {
+            continue;
+        }
+        const char *script = strtok_r(NULL, " \t\r\n", &rest);
+
+        if (strtok_r(NULL, " \t\r\n", &rest) != NULL) {
+            fprintf(stderr, "%s:%zu: expected <rom> [script]\n", path,
+                    number);
+            ok = false;
+            break;
+        }
+
+        char *rom_path = join_path(dir, rom);
+        char *script_path = script != NULL ? join_path(dir, script) : NULL;
+
+        if (rom_path == NULL || (script != NULL && script_path == NULL) ||
+            !add_job(fleet, &capacity, rom_path, script_path)) {
+            fprintf(stderr, "Out of memory\n");
+            free(rom_path);
+            free(script_path);
+            ok = false;
+        }
+    }
+
+    free(dir);
+    fclose(file);
+    return ok;
+}
+
+static void put_json_string(FILE *out, const char *text) {
+    if (text == NULL) {
+        fputs("null", out);
+        return;
+    }
+
+    fputc('"', out);
+    for (const unsigned char *c = (const unsigned char *)text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(out, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(out, "\\u%04x", *c);
+        } else {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+/**
+ * Runs a job on the emulator of a worker.
+ *
+ * @param worker The worker.
+ * @param job    The job.
+ * @return The result as a newly allocated JSON object, without a newline.
+ */
+static char *run_job(fleet_worker *worker, const fleet_job *job) {
+    const fleet_config *config = worker->fleet->config;
+    chip_8 *emu = &worker->emu;
+
+    char *line = NULL;
+    size_t size = 0;
+    FILE *out = open_memstream(&line, &size);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    fputs("{\"rom\":", out);
+    put_json_string(out, job->rom);
+    fputs(",\"script\":", out);
+    put_json_string(out, job->script);
+
+    chip_8_init(emu);
+    chip_8_set_ips(emu, config->ips);
+    chip_8_seed(emu, config->seed);
+    chip_8_set_quirks(emu, config->quirks);
+
+    if (!chip_8_load(emu, job->rom) ||
+        (job->script != NULL &&
+         !job_load_script(&worker->script, job->script))) {
+        fputs(",\"status\":\"error\"}", out);
+        fclose(out);
+        return line;
+    }
+
+    // -c takes precedence; otherwise run whole frames of emulated time.
+    uint64_t max_cycles = config->max_cycles;
+    if (max_cycles == 0) {
+        max_cycles = config->max_frames * emu->_ips / TIMER_HZ;
+    }
+
+    job_result result =
+        job_run(emu, job->script != NULL ? &worker->script : NULL, max_cycles,
+                config->engine);
+
+    const char *status = "ok";
+    if (emu->_fault != CHIP_8_FAULT_NONE) {
+        status = "fault";
+    } else if (result.waiting) {
+        status = "waiting";
+    }
+
+    fprintf(out, ",\"status\":\"%s\",\"fault\":", status);
+    put_json_string(out, emu->_fault != CHIP_8_FAULT_NONE
+                             ? chip_8_fault_name(emu->_fault)
+                             : NULL);
+    fprintf(out, ",\"cycles\":%llu,\"draws\":%llu",
+            (unsigned long long)result.cycles,
+            (unsigned long long)result.draws);
+    fprintf(out, ",\"pc\":%u,\"i\":%u,\"sp\":%u,\"dt\":%u,\"st\":%u,\"v\":[",
+            emu->_pc, emu->_I, emu->_sp, emu->_delay_timer,
+            emu->_sound_timer);
+    for (size_t i = 0; i < REGISTERS; i++) {
+        fprintf(out, "%u%s", emu->_V[i], i + 1 < REGISTERS ? "," : "]");
+    }
+    fprintf(out, ",\"fb_hash\":\"%016llx\",\"seconds\":%.6f}",
+            (unsigned long long)job_hash_framebuffer(emu), result.seconds);
+
+    fclose(out);
+    return line;
+}
+
+/**
+ * Takes the next job of a worker, from its own queue or else from another.
+ *
+ * @param worker The worker.
+ * @param job    Set to the index of the job.
+ * @return True if a job was found, False once every queue is empty.
+ */
+static bool next_job(fleet_worker *worker, size_t *job) {
+    fleet_queue *own = &worker->queue;
+
+    pthread_mutex_lock(&own->lock);
+    bool found = own->top < own->bottom;
+    if (found) {
+        *job = own->jobs[--own->bottom];
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    // No new jobs appear once the run starts, so one sweep over the other
+    // queues that finds nothing means the run is over.
+    fleet *fleet = worker->fleet;
+    for (size_t i = 1; !found && i < fleet->worker_count; i++) {
+        fleet_queue *victim =
+            &fleet->workers[(worker->id + i) % fleet->worker_count].queue;
+
+        pthread_mutex_lock(&victim->lock);
+        found = victim->top < victim->bottom;
+        if (found) {
+            *job = victim->jobs[victim->top++];
+        }
+        pthread_mutex_unlock(&victim->lock);
+    }
+
+    return found;
+}
+
+static void *work(void *arg) {
+    fleet_worker *worker = arg;
+    size_t job;
+
+    while (next_job(worker, &job)) {
+        fleet_job *current = &worker->fleet->jobs[job];
+        current->line = run_job(worker, current);
+    }
+
+    return NULL;
+}
+
+/**
+ * Runs every job on a pool of worker threads.
+ *
+ * Jobs are dealt round-robin into per-worker queues, and workers that run
+ * out steal from the others.
+ *
+ * @param fleet   The fleet with its jobs.
+ * @param threads The number of worker threads.
+ * @return True if the workers could be started, False otherwise.
+ */
+static bool run_fleet(fleet *fleet, size_t threads) {
+    if (threads > fleet->job_count) {
+        threads = fleet->job_count > 0 ? fleet->job_count : 1;
+    }
+
+    // The emulators inside need their cache-line alignment, which malloc
+    // does not promise.
+    fleet->workers =
+        aligned_alloc(_Alignof(fleet_worker), threads * sizeof(fleet_worker));
+    if (fleet->workers == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return false;
+    }
+    memset(fleet->workers, 0, threads * sizeof(fleet_worker));
+    fleet->worker_count = threads;
+
+    for (size_t i = 0; i < threads; i++) {
+        fleet_worker *worker = &fleet->workers[i];
+        worker->id = i;
+        worker->fleet = fleet;
+
+        fleet_queue *queue = &worker->queue;
+        pthread_mutex_init(&queue->lock, NULL);
+        queue->jobs = malloc((fleet->job_count / threads + 1) * sizeof(size_t));
+        if (queue->jobs == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return false;
+        }
+    }
+
+    for (size_t job = 0; job < fleet->job_count; job++) {
+        fleet_queue *queue = &fleet->workers[job % threads].queue;
+        queue->jobs[queue->bottom++] = job;
+    }
+
+    size_t started = 0;
+    for (; started < threads; started++) {
+        fleet_worker *worker = &fleet->workers[started];
+        if (pthread_create(&worker->thread, NULL, work, worker) != 0) {
+            fprintf(stderr, "Failed to start worker threads\n");
+            break;
+        }
+    }
+
+    // Workers that did start still finish every job between them.
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(fleet->workers[i].thread, NULL);
+    }
+
+    return started > 0;
+}
+
+static void free_fleet(fleet *fleet) {
+    for (size_t i = 0; i < fleet->job_count; i++) {
+        free(fleet->jobs[i].rom);
+        free(fleet->jobs[i].script);
+        free(fleet->jobs[i].line);
+    }
+    free(fleet->jobs);
+
+    for (size_t i = 0; i < fleet->worker_count; i++) {
+        pthread_mutex_destroy(&fleet->workers[i].queue.lock);
+        free(fleet->workers[i].queue.jobs);
+    }
+    free(fleet->workers);
+}
+
+int main(int argc, char **argv) {
+    fleet_config config = {0, DEFAULT_FRAMES, DEFAULT_IPS, DEFAULT_SEED, 0,
+                           JOB_ENGINE_INTERPRETER};
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *output = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bc:f:i:j:Jo:r:w")) != -1) {
+        switch (opt) {
+        case 'b':
+            config.engine = JOB_ENGINE_BLOCKS;
+            break;
+        case 'c':
+            config.max_cycles = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            config.max_frames = strtoull(optarg, NULL, 10);
+            break;
+        case 'i':
+            config.ips = strtoul(optarg, NULL, 10);
+            break;
+        case 'j':
+            threads = strtol(optarg, NULL, 10);
+            break;
+        case 'J':
+            config.engine = JOB_ENGINE_JIT;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'r':
+            config.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'w':
+            config.quirks |= CHIP_8_QUIRK_WRAP;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage();
+        return 1;
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    fleet fleet = {&config, NULL, 0, NULL, 0};
+    const char *source = argv[optind];
+
+    struct stat info;
+    if (stat(source, &info) != 0) {
+        fprintf(stderr, "Failed to open: %s\n", source);
+        return 1;
+    }
+
+    bool loaded = S_ISDIR(info.st_mode) ? load_directory(&fleet, source)
+                                        : load_manifest(&fleet, source);
+    if (!loaded) {
+        free_fleet(&fleet);
+        return 1;
+    }
+
+    FILE *out = output != NULL ? fopen(output, "w") : stdout;
+    if (out == NULL) {
+        fprintf(stderr, "Failed to open output: %s\n", output);
+        free_fleet(&fleet);
+        return 1;
+    }
+
+    int status = run_fleet(&fleet, threads) ? 0 : 1;
+
+    // Results are written in job order, whichever worker ran them.
+    for (size_t i = 0; i < fleet.job_count && status == 0; i++) {
+        if (fleet.jobs[i].line == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            status = 1;
+            break;
+        }
+        fprintf(out, "%s\n", fleet.jobs[i].line);
+    }
+
+    if (out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "Failed to write output: %s\n", output);
+        status = 1;
+    }
+
+    free_fleet(&fleet);
+    return status;
+}
@@ -0,0 +1,163 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "chip_8.h"
+#include "chip_8_profile.h"
+#include "job.h"
+
+#define DEFAULT_FRAMES 600
+
+static chip_8 emu;
+static job_script script;
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage: ./chip8-headless [-b | -J] [-c cycles | -f frames] "
+            "[-i ips] [-k script] [-m heatmap] [-r seed] [-s] [-w] "
+            "<path-to-rom>\n");
+}
+
+static void print_screen(const chip_8 *emu) {
+    for (size_t y = 0; y < FB_HEIGHT; y++) {
+        for (size_t x = 0; x < FB_WIDTH; x++) {
+            putchar(chip_8_pixel(emu, x, y) ? '#' : '.');
+        }
+        putchar('\n');
+    }
+}
+
+/**
+ * Writes the fetch counts of every address to <prefix>.csv and
+ * <prefix>.ppm.
+ *
+ * @param emu    The emulator structure.
+ * @param prefix The path of both files without the extension.
+ * @return True if both files were written, False otherwise.
+ */
+static bool write_heatmap(const chip_8 *emu, const char *prefix) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s.csv", prefix);
+    if (!chip_8_profile_write_csv(emu, path)) {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "%s.ppm", prefix);
+    return chip_8_profile_write_ppm(emu, path);
+}
+
+int main(int argc, char **argv) {
+    unsigned long long max_cycles = 0;
+    unsigned long long max_frames = DEFAULT_FRAMES;
+    unsigned long ips = DEFAULT_IPS;
+    unsigned long long seed = DEFAULT_SEED;
+    unsigned quirks = 0;
+    const char *heatmap = NULL;
+    job_engine engine = JOB_ENGINE_INTERPRETER;
+    bool screen = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "bc:f:i:Jk:m:r:sw")) != -1) {
+        switch (opt) {
+        case 'b':
+            engine = JOB_ENGINE_BLOCKS;
+            break;
+        case 'c':
+            max_cycles = strtoull(optarg, NULL, 10);
+            break;
+        case 'f':
+            max_frames = strtoull(optarg, NULL, 10);
+            break;
+        case 'i':
+            ips = strtoul(optarg, NULL, 10);
+            break;
+        case 'J':
+            engine = JOB_ENGINE_JIT;
+            break;
+        case 'k':
+            if (!job_load_script(&script, optarg)) {
+                return 1;
+            }
+            break;
+        case 'm':
+            heatmap = optarg;
+            break;
+        case 'r':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 's':
+            screen = true;
+            break;
+        case 'w':
+            quirks |= CHIP_8_QUIRK_WRAP;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+
+    if (optind != argc - 1) {
+        usage();
+        return 1;
+    }
+
+    chip_8_init(&emu);
+    chip_8_set_ips(&emu, ips);
+    chip_8_seed(&emu, seed);
+    chip_8_set_quirks(&emu, quirks);
+
+    if (!chip_8_load(&emu, argv[optind])) {
+        fprintf(stderr, "Failed to load ROM\n");
+        return 1;
+    }
+
+    // -c takes precedence; otherwise run whole frames of emulated time.
+    if (max_cycles == 0) {
+        max_cycles = max_frames * emu._ips / TIMER_HZ;
+    }
+
+    job_result result = job_run(&emu, &script, max_cycles, engine);
+
+    int status = 0;
+    if (emu._fault != CHIP_8_FAULT_NONE) {
+        fprintf(stderr, "%s: %04x at %03x\n", chip_8_fault_name(emu._fault),
+                emu._opcode, emu._pc);
+        status = 1;
+    }
+
+    printf("cycles=%llu draws=%llu waiting=%d\n",
+           (unsigned long long)result.cycles,
+           (unsigned long long)result.draws, result.waiting);
+    printf("pc=%03x i=%03x sp=%u dt=%u st=%u\n", emu._pc, emu._I, emu._sp,
+           emu._delay_timer, emu._sound_timer);
+    printf("v=");
+    for (size_t i = 0; i < REGISTERS; i++) {
+        printf("%02x%c", emu._V[i], i + 1 < REGISTERS ? ' ' : '\n');
+    }
+    printf("fb_hash=%016llx\n",
+           (unsigned long long)job_hash_framebuffer(&emu));
+    printf("seconds=%.6f mips=%.2f\n", result.seconds,
+           result.seconds > 0 ? result.cycles / result.seconds / 1e6 : 0.0);
+
+    if (screen) {
+        print_screen(&emu);
+    }
+
+#ifdef CHIP_8_PROFILE
+    chip_8_profile_report(&emu, stderr);
+#endif
+
+    // Kept off stdout so that both engines print the same results.
+    if (engine != JOB_ENGINE_INTERPRETER) {
+        chip_8_dump_blocks(&emu, stderr);
+    }
+
+    if (heatmap != NULL && !write_heatmap(&emu, heatmap)) {
+        status = 1;
+    }
+
+    return status;
+}
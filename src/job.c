@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "chip_8_jit.h"
+#include "job.h"
+
+bool job_load_script(job_script *script, const char *path) {
+    script->count = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Failed to open input script: %s\n", path);
+        return false;
+    }
+
+    char line[256];
+    size_t number = 0;
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        number++;
+
+        const char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\0') {
+            continue;
+        }
+
+        unsigned long long frame;
+        unsigned key, down;
+
+        if (sscanf(text, "%llu %x %u", &frame, &key, &down) != 3 ||
+            key >= KEYMAP_SIZE || down > 1) {
+            fprintf(stderr, "%s:%zu: expected <frame> <key> <0|1>\n", path,
+                    number);
+            fclose(file);
+            return false;
+        }
+
+        if (script->count > 0 &&
+            frame < script->events[script->count - 1].frame) {
+            fprintf(stderr, "%s:%zu: events are not in frame order\n", path,
+                    number);
+            fclose(file);
+            return false;
+        }
+
+        if (script->count == MAX_EVENTS) {
+            fprintf(stderr, "%s: more than %d events\n", path, MAX_EVENTS);
+            fclose(file);
+            return false;
+        }
+
+        script->events[script->count++] = (input_event){frame, key, down};
+    }
+
+    fclose(file);
+    return true;
+}
+
+/**
+ * Runs a batch of cycles a block at a time, and the last few one at a time
+ * so that the batch ends on its budget like chip_8_step_n.
+ *
+ * @param emu    The emulator structure.
+ * @param jit    The JIT running the blocks, or NULL for the block cache.
+ * @param budget The number of cycles to run.
+ * @return The cycles executed, the screen updates and why the batch ended.
+ */
+static chip_8_result job_step_blocks(chip_8 *emu, chip_8_jit *jit,
+                                     uint32_t budget) {
+    chip_8_result result = {0, 0, CHIP_8_EXIT_BUDGET};
+
+    while (result.cycles < budget) {
+        if (emu->_fault != CHIP_8_FAULT_NONE) {
+            result.reason = CHIP_8_EXIT_ERROR;
+            break;
+        }
+
+        uint64_t start = emu->_cycles;
+
+        // A block never runs more than BLOCK_MAX_LEN cycles.
+        if (budget - result.cycles < BLOCK_MAX_LEN) {
+            result.draws += chip_8_emulate_cycle(emu);
+        } else if (jit != NULL) {
+            result.draws += chip_8_jit_emulate_block(jit, emu);
+        } else {
+            result.draws += chip_8_emulate_block(emu);
+        }
+
+        result.cycles += emu->_cycles - start;
+
+        if (emu->_fault != CHIP_8_FAULT_NONE) {
+            result.reason = CHIP_8_EXIT_ERROR;
+            break;
+        }
+
+        // Only Fx0A waiting for a key stops a block without a cycle.
+        if (emu->_cycles == start) {
+            result.reason = CHIP_8_EXIT_KEY_WAIT;
+            break;
+        }
+    }
+
+    return result;
+}
+
+job_result job_run(chip_8 *emu, const job_script *script, uint64_t max_cycles,
+                   job_engine engine) {
+    job_result result = {0, 0, false, 0};
+
+    // Without the JIT compiled in, chip_8_jit_emulate_block only interprets.
+    chip_8_jit *jit = NULL;
+    if (engine == JOB_ENGINE_JIT) {
+        jit = malloc(sizeof(*jit));
+        if (jit == NULL) {
+            fprintf(stderr, "Failed to allocate the JIT\n");
+        } else {
+            chip_8_jit_init(jit);
+        }
+    }
+
+    size_t event_count = script != NULL ? script->count : 0;
+    uint64_t frame = 0;
+    size_t next = 0;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (result.cycles < max_cycles) {
+        while (next < event_count && script->events[next].frame <= frame) {
+            emu->_keymap[script->events[next].key] = script->events[next].down;
+            next++;
+        }
+
+        // Frame lengths alternate so that rates not divisible by 60 add up.
+        uint64_t frame_end = (frame + 1) * emu->_ips / TIMER_HZ;
+        uint64_t budget = frame_end - frame * emu->_ips / TIMER_HZ;
+
+        // Once the script is used up the rest can run as a single batch.
+        if (budget > max_cycles - result.cycles || next == event_count) {
+            budget = max_cycles - result.cycles;
+        }
+
+        // Batches are bounded by what a single call can count.
+        if (budget > UINT32_MAX) {
+            budget = UINT32_MAX;
+        }
+
+        chip_8_result batch = engine == JOB_ENGINE_INTERPRETER
+                                  ? chip_8_step_n(emu, budget)
+                                  : job_step_blocks(emu, jit, budget);
+        result.cycles += batch.cycles;
+        result.draws += batch.draws;
+        frame++;
+
+        if (batch.reason == CHIP_8_EXIT_ERROR) {
+            break;
+        }
+
+        // Nothing left in the script can release Fx0A.
+        if (batch.reason == CHIP_8_EXIT_KEY_WAIT && next == event_count) {
+            result.waiting = true;
+            break;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (jit != NULL) {
+        chip_8_jit_free(jit);
+        free(jit);
+    }
+
+    result.seconds =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return result;
+}
+
+uint64_t job_hash_framebuffer(const chip_8 *emu) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+
+    for (size_t y = 0; y < FB_HEIGHT; y++) {
+        for (size_t x = 0; x < FB_WIDTH; x++) {
+            hash ^= chip_8_pixel(emu, x, y);
+            hash *= 0x100000001b3ULL;
+        }
+    }
+
+    return hash;
+}
@@ -0,0 +1,89 @@
+#ifndef JOB_H
+#define JOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chip_8.h"
+
+#define MAX_EVENTS 4096
+
+/**
+ * A scripted key press or release, applied at the start of a frame.
+ */
+typedef struct input_event {
+    uint64_t frame;
+    uint8_t key;
+    uint8_t down;
+} input_event;
+
+/**
+ * The key presses and releases of a run, in frame order.
+ */
+typedef struct job_script {
+    input_event events[MAX_EVENTS];
+    size_t count;
+} job_script;
+
+/**
+ * How job_run executes the ROM. Every engine gives the same results.
+ */
+typedef enum job_engine {
+    // chip_8_step_n, the direct-threaded interpreter.
+    JOB_ENGINE_INTERPRETER,
+    // chip_8_emulate_block, through the basic-block cache.
+    JOB_ENGINE_BLOCKS,
+    // chip_8_jit_emulate_block, natively in builds with JIT=1.
+    JOB_ENGINE_JIT
+} job_engine;
+
+/**
+ * The outcome of a run.
+ */
+typedef struct job_result {
+    uint64_t cycles;
+    uint64_t draws;
+    // Fx0A was left waiting for a key that the script never presses.
+    bool waiting;
+    double seconds;
+} job_result;
+
+/**
+ * Loads an input script.
+ *
+ * Every line holds a frame number, a hexadecimal key and 1 for a press or 0
+ * for a release, in frame order. Empty lines and lines starting with # are
+ * skipped.
+ *
+ * @param script The script to fill.
+ * @param path   The path to the script.
+ * @return True if the script was loaded successfully, False otherwise.
+ */
+bool job_load_script(job_script *script, const char *path);
+
+/**
+ * Runs a loaded ROM without a display, in 60 Hz frames of emulated time so
+ * that the script applies its events at the right points.
+ *
+ * The run ends after max_cycles cycles, on a fault, which is left in _fault,
+ * or when Fx0A waits for a key after the script has ended.
+ *
+ * @param emu        The emulator structure.
+ * @param script     The input script, or NULL for none.
+ * @param max_cycles The number of cycles to run.
+ * @param engine     How to execute the ROM.
+ * @return The cycles executed, the screen updates and the time taken.
+ */
+job_result job_run(chip_8 *emu, const job_script *script, uint64_t max_cycles,
+                   job_engine engine);
+
+/**
+ * Hashes the screen contents with 64-bit FNV-1a, one pixel at a time.
+ *
+ * @param emu The emulator structure.
+ * @return The hash of the framebuffer.
+ */
+uint64_t job_hash_framebuffer(const chip_8 *emu);
+
+#endif // JOB_H
@@ -1,14 +1,49 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "raylib.h"
 
 #include "chip_8.h"
+#include "chip_8_profile.h"
+#include "chip_8_rewind.h"
+#include "triple_buffer.h"
 
-#define TARGET_FPS 250
+#ifdef CHIP_8_AOT
+#include "chip_8_aot.h"
+#endif
+
+#define TARGET_FPS 60
 #define WINDOW_WIDTH 800
 #define WINDOW_HEIGHT 600
 
+// Hold to fast-forward, cycle the fast-forward speed, toggle the readout,
+// hold to rewind.
+#define FAST_FORWARD_KEY KEY_TAB
+#define SPEED_KEY        KEY_F2
+#define OVERLAY_KEY      KEY_F1
+#define REWIND_KEY       KEY_BACKSPACE
+
+// Enough for about ten minutes of rewind in typical games.
+#define REWIND_CAPACITY (4 * 1024 * 1024)
+
+// Fast-forward multipliers; SPEED_UNCAPPED runs frames back to back, in
+// batches of UNCAPPED_FRAMES.
+#define SPEED_UNCAPPED  0
+#define UNCAPPED_FRAMES 100
+
+#ifdef CHIP_8_AOT
+#define USAGE "./<rom> [-i instructions-per-second] [-w]"
+#else
+#define USAGE "./main [-i instructions-per-second] [-w] <path-to-file>"
+#endif
+
+static const unsigned speeds[] = {2, 4, SPEED_UNCAPPED};
+
 uint8_t keymap[KEYMAP_SIZE] = {
     KEY_X,
     KEY_ONE,
@@ -28,23 +63,329 @@ uint8_t keymap[KEYMAP_SIZE] = {
     KEY_V
 };
 
-int main(int argc, char **argv) {
+/**
+ * State shared between the window thread and the emulation thread.
+ *
+ * The emulator itself is only touched by the emulation thread; input comes
+ * in through keys, one bit per CHIP-8 key, speed, the current speed
+ * multiplier, and rewinding. Frames go out through the triple buffer, and the
+ * number of instructions run for the IPS readout through executed. Unlike
+ * the clock of the emulator, it does not go back when rewinding.
+ *
+ * While the game can only wait for a key, the emulation thread sleeps on
+ * input, which the window thread signals when keys or rewinding change, and
+ * sets idle so that the window thread waits for events instead of drawing.
+ */
+typedef struct frontend {
     chip_8 emu;
-    chip_8_init(&emu);
+    chip_8_rewind rewind;
+    bool has_rewind;
+    triple_buffer frames;
+    atomic_uint keys;
+    atomic_uint speed;
+    atomic_bool rewinding;
+    _Atomic uint64_t executed;
+    atomic_bool running;
+    pthread_mutex_t lock;
+    pthread_cond_t input;
+    atomic_bool idle;
+} frontend;
+
+static frontend fe;
+
+/**
+ * Runs one frame worth of cycles.
+ *
+ * @param emu    The emulator structure.
+ * @param budget The number of cycles in the frame.
+ * @return Why the frame ended: the budget, a loop or Fx0A waiting for a
+ *         key, or a fault.
+ */
+static chip_8_exit run_frame(chip_8 *emu, uint32_t budget) {
+#ifdef CHIP_8_AOT
+    // Translated code first, the interpreter for anything it leaves.
+    while (budget > 0) {
+        bool draw;
+        uint32_t cycles = chip_8_aot_run(emu, budget, &draw);
+
+        if (cycles == 0) {
+            chip_8_result result = chip_8_step_n(emu, 1);
+            if (result.reason != CHIP_8_EXIT_BUDGET) {
+                return result.reason;
+            }
+            cycles = result.cycles;
+        }
+
+        budget -= cycles;
+    }
+
+    return CHIP_8_EXIT_BUDGET;
+#else
+    return chip_8_run_until(emu, budget,
+                            CHIP_8_EXIT_KEY_WAIT | CHIP_8_EXIT_IDLE |
+                                CHIP_8_EXIT_ERROR)
+        .reason;
+#endif
+}
+
+/**
+ * Returns the time between two points in nanoseconds.
+ *
+ * @param from The earlier point.
+ * @param to   The later point.
+ * @return The elapsed time in nanoseconds.
+ */
+static long long elapsed_ns(const struct timespec *from,
+                            const struct timespec *to) {
+    return (to->tv_sec - from->tv_sec) * 1000000000LL +
+           (to->tv_nsec - from->tv_nsec);
+}
+
+/**
+ * Sleeps until the window thread sees the keys or rewinding change, or the
+ * window closes.
+ *
+ * @param state     The frontend structure.
+ * @param keys      The keys the last frame ran with.
+ * @param rewinding Whether the rewind key was held for the last frame.
+ */
+static void wait_for_input(frontend *state, unsigned keys, bool rewinding) {
+    pthread_mutex_lock(&state->lock);
+
+    while (atomic_load(&state->running) && atomic_load(&state->keys) == keys &&
+           atomic_load(&state->rewinding) == rewinding) {
+        atomic_store(&state->idle, true);
+        pthread_cond_wait(&state->input, &state->lock);
+    }
+
+    atomic_store(&state->idle, false);
+    pthread_mutex_unlock(&state->lock);
+}
+
+/**
+ * Wakes the emulation thread if it sleeps in wait_for_input.
+ *
+ * @param state The frontend structure.
+ */
+static void wake_emulation(frontend *state) {
+    pthread_mutex_lock(&state->lock);
+    atomic_store(&state->idle, false);
+    pthread_cond_signal(&state->input);
+    pthread_mutex_unlock(&state->lock);
+}
+
+/**
+ * Runs the emulator in frames of TIMER_HZ per second, independent of the
+ * display, publishing a snapshot of the framebuffer whenever it changes.
+ *
+ * While fast-forwarding, several frames run per tick, or as many as the host
+ * allows, and at most one snapshot is published per tick of real time so
+ * that presenting does not hold back the core. While rewinding, every tick
+ * restores the state from one frame earlier instead.
+ *
+ * Once the game waits for a key with both timers at zero, nothing but the
+ * clock would change until a key does, so the thread sleeps until input
+ * changes rather than running empty frames. The emulated time stands still
+ * meanwhile, as it does while paused.
+ *
+ * @param arg The frontend structure.
+ */
+static void *emulate(void *arg) {
+    frontend *state = arg;
+    chip_8 *emu = &state->emu;
+
+    const long period = 1000000000L / TIMER_HZ;
+    struct timespec deadline, published;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    published = deadline;
+
+    uint64_t tick = 0;
+    uint64_t executed = 0;
+
+    while (atomic_load_explicit(&state->running, memory_order_relaxed)) {
+        unsigned keys = atomic_load(&state->keys);
+        for (size_t i = 0; i < KEYMAP_SIZE; i++) {
+            emu->_keymap[i] = (keys >> i) & 1;
+        }
+
+        bool rewind_key = atomic_load(&state->rewinding);
+        bool rewinding = state->has_rewind && rewind_key;
+        unsigned speed =
+            rewinding ? 1
+                      : atomic_load_explicit(&state->speed,
+                                             memory_order_relaxed);
+
+        bool waiting = false;
+
+        if (rewinding) {
+            // At the oldest frame left the game simply holds still.
+            chip_8_rewind_pop(&state->rewind, emu);
+        } else {
+            // A fault halts the game until rewinding restores a frame from
+            // before it.
+            bool faulted = emu->_fault != CHIP_8_FAULT_NONE;
+            if (state->has_rewind && !faulted) {
+                chip_8_rewind_push(&state->rewind, emu);
+            }
+
+            uint32_t frames =
+                speed == SPEED_UNCAPPED ? UNCAPPED_FRAMES : speed;
+
+            // Frame lengths alternate so that rates not divisible by 60 add
+            // up.
+            uint32_t budget = (tick + frames) * emu->_ips / TIMER_HZ -
+                              tick * emu->_ips / TIMER_HZ;
+            tick += frames;
+
+            // A waiting Fx0A simply idles for the rest of the frame.
+            uint64_t start = emu->_cycles;
+            chip_8_exit reason = run_frame(emu, budget);
+            executed += emu->_cycles - start;
+            if (reason == CHIP_8_EXIT_ERROR && !faulted) {
+                fprintf(stderr, "%s: %04x at %03x\n",
+                        chip_8_fault_name(emu->_fault), emu->_opcode,
+                        emu->_pc);
+            }
+
+            waiting = (reason == CHIP_8_EXIT_KEY_WAIT ||
+                       reason == CHIP_8_EXIT_IDLE) &&
+                      emu->_delay_timer == 0 && emu->_sound_timer == 0;
+        }
+
+        atomic_store_explicit(&state->executed, executed,
+                              memory_order_relaxed);
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        if (emu->_dirty_rows != 0 &&
+            (speed == 1 || waiting || elapsed_ns(&published, &now) >= period)) {
+            chip_8_frame *frame = triple_buffer_back(&state->frames);
+            memcpy(frame->rows, emu->_framebuffer, sizeof(frame->rows));
+            triple_buffer_publish(&state->frames);
+            emu->_dirty_rows = 0;
+            published = now;
+        }
+
+        if (waiting) {
+            wait_for_input(state, keys, rewind_key);
+            clock_gettime(CLOCK_MONOTONIC, &deadline);
+            continue;
+        }
+
+        if (speed == SPEED_UNCAPPED) {
+            deadline = now;
+            continue;
+        }
+
+        deadline.tv_nsec += period;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_nsec -= 1000000000L;
+            deadline.tv_sec++;
+        }
+
+        // After a long stall, carry on from now instead of catching up.
+        if (now.tv_sec > deadline.tv_sec + 1) {
+            deadline = now;
+        }
 
-    if (argc != 2) {
-        fprintf(stderr, "Invalid arguments. Usage: ./main <path-to-file>\n");
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+    }
+
+    return NULL;
+}
+
+/**
+ * Converts the rows of a frame that differ from the one on screen and
+ * uploads them, one rectangle per run of consecutive changed rows.
+ *
+ * @param texture The texture the frame is drawn from.
+ * @param pixels  The pixels of the texture.
+ * @param shown   The rows currently in the texture, updated to the frame.
+ * @param frame   The new frame.
+ */
+static void upload_frame(Texture2D texture, Color *pixels, uint64_t *shown,
+                         const chip_8_frame *frame) {
+    for (size_t y = 0; y < FB_HEIGHT; y++) {
+        if (shown[y] == frame->rows[y]) {
+            continue;
+        }
+
+        size_t first = y;
+        for (; y < FB_HEIGHT && shown[y] != frame->rows[y]; y++) {
+            for (size_t x = 0; x < FB_WIDTH; x++) {
+                if ((frame->rows[y] >> (FB_WIDTH - 1 - x)) & 1) {
+                    pixels[y * FB_WIDTH + x] = WHITE;
+                } else {
+                    pixels[y * FB_WIDTH + x] = BLACK;
+                }
+            }
+            shown[y] = frame->rows[y];
+        }
+
+        UpdateTextureRec(texture,
+            (Rectangle){0, first, FB_WIDTH, y - first},
+            &pixels[first * FB_WIDTH]);
+    }
+}
+
+int main(int argc, char **argv) {
+    chip_8 *emu = &fe.emu;
+    chip_8_init(emu);
+
+    unsigned long ips = DEFAULT_IPS;
+    unsigned quirks = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:w")) != -1) {
+        switch (opt) {
+        case 'i':
+            ips = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            quirks |= CHIP_8_QUIRK_WRAP;
+            break;
+        default:
+            fprintf(stderr, "Invalid arguments. Usage: %s\n", USAGE);
+            return 1;
+        }
+    }
+
+#ifdef CHIP_8_AOT
+    // The ROM is compiled into the binary.
+    bool loaded = chip_8_load_rom(emu, chip_8_aot_rom, chip_8_aot_rom_size);
+#else
+    if (optind != argc - 1) {
+        fprintf(stderr, "Invalid arguments. Usage: %s\n", USAGE);
         return 1;
     }
 
-    const char *path = argv[1];
+    const char *path = argv[optind];
 
-    if (!chip_8_load(&emu, path)) {
+    bool loaded = chip_8_load(emu, path);
+#endif
+
+    if (!loaded) {
         fprintf(stderr, "Failed to load ROM\n");
         return 1;
     }
 
-    bool draw = false;
+    // The emulation thread runs ips / TIMER_HZ cycles per frame.
+    chip_8_set_ips(emu, ips);
+    chip_8_set_quirks(emu, quirks);
+
+    // The emulator still runs without rewind if the buffer is unavailable.
+    fe.has_rewind = chip_8_rewind_init(&fe.rewind, REWIND_CAPACITY);
+
+    triple_buffer_init(&fe.frames);
+    atomic_init(&fe.keys, 0);
+    atomic_init(&fe.speed, 1);
+    atomic_init(&fe.rewinding, false);
+    atomic_init(&fe.executed, 0);
+    atomic_init(&fe.running, true);
+    atomic_init(&fe.idle, false);
+    pthread_mutex_init(&fe.lock, NULL);
+    pthread_cond_init(&fe.input, NULL);
 
     InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "CHIP-8 Emulator");
 
@@ -54,38 +395,78 @@ int main(int argc, char **argv) {
     UnloadImage(image);
 
     Color pixels[FB_SIZE];
+    uint64_t shown[FB_HEIGHT] = {0};
 
     SetTargetFPS(TARGET_FPS);
 
-    while (!WindowShouldClose()) {
-        draw = chip_8_emulate_cycle(&emu);
+    size_t speed = 0;
+    bool overlay = false;
+
+    // Instructions per second, measured over the last second.
+    double ips_time = 0;
+    uint64_t ips_cycles = 0;
+    double measured_ips = 0;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, emulate, &fe) != 0) {
+        fprintf(stderr, "Failed to start the emulation thread\n");
+        CloseWindow();
+        return 1;
+    }
 
+    while (!WindowShouldClose()) {
+        unsigned keys = 0;
         for (size_t i = 0; i < KEYMAP_SIZE; i++) {
             if (IsKeyDown(keymap[i])) {
-                emu._keymap[i] = 1;
+                keys |= 1u << i;
             }
+        }
+        bool rewind_key = IsKeyDown(REWIND_KEY);
 
-            if (IsKeyUp(keymap[i])) {
-                emu._keymap[i] = 0;
-            }
+        bool changed = keys != atomic_load(&fe.keys) ||
+                       rewind_key != atomic_load(&fe.rewinding);
+        atomic_store(&fe.keys, keys);
+        atomic_store(&fe.rewinding, rewind_key);
+        if (changed) {
+            wake_emulation(&fe);
         }
 
-        BeginDrawing();
+        if (IsKeyPressed(SPEED_KEY)) {
+            speed = (speed + 1) % (sizeof(speeds) / sizeof(speeds[0]));
+        }
+        if (IsKeyPressed(OVERLAY_KEY)) {
+            overlay = !overlay;
+        }
 
-        // If a draw has occurred in the emulator, loop through the framebuffer
-        // and update the texture.
-        if (draw) {
-            for (size_t i = 0; i < FB_SIZE; i++) {
-                if (emu._framebuffer[i]) {
-                    pixels[i] = WHITE;
-                } else {
-                    pixels[i] = BLACK;
-                }
-            }
+        bool fast_forward = IsKeyDown(FAST_FORWARD_KEY);
+        atomic_store_explicit(&fe.speed, fast_forward ? speeds[speed] : 1,
+                              memory_order_relaxed);
+
+        double time = GetTime();
+        if (time - ips_time >= 1.0) {
+            uint64_t cycles =
+                atomic_load_explicit(&fe.executed, memory_order_relaxed);
+            measured_ips = (cycles - ips_cycles) / (time - ips_time);
+            ips_cycles = cycles;
+            ips_time = time;
+        }
 
-            UpdateTexture(texture, pixels);
+        // An idle game only moves again on input, so until then the window
+        // is redrawn on events alone.
+        if (atomic_load(&fe.idle)) {
+            EnableEventWaiting();
+        } else {
+            DisableEventWaiting();
         }
-        
+
+        BeginDrawing();
+
+        // Present the latest frame the emulation thread completed, if any.
+        const chip_8_frame *frame = triple_buffer_acquire(&fe.frames);
+        if (frame != NULL) {
+            upload_frame(texture, pixels, shown, frame);
+        }
+
         ClearBackground(BLACK);
 
         DrawTexturePro(texture,
@@ -95,9 +476,35 @@ int main(int argc, char **argv) {
             0.0f,
             WHITE);
 
+        if (overlay || fast_forward) {
+            char speed_label[16] = "x1";
+            if (fast_forward && speeds[speed] == SPEED_UNCAPPED) {
+                snprintf(speed_label, sizeof(speed_label), "max");
+            } else if (fast_forward) {
+                snprintf(speed_label, sizeof(speed_label), "x%u",
+                         speeds[speed]);
+            }
+
+            DrawText(TextFormat("IPS %.0f  FPS %d  %s", measured_ips,
+                                GetFPS(), speed_label),
+                     8, 8, 20, GREEN);
+        }
+
         EndDrawing();
     }
 
+    atomic_store(&fe.running, false);
+    wake_emulation(&fe);
+    pthread_join(thread, NULL);
+
+#ifdef CHIP_8_PROFILE
+    chip_8_profile_report(emu, stderr);
+#endif
+
+    if (fe.has_rewind) {
+        chip_8_rewind_free(&fe.rewind);
+    }
+
     CloseWindow();
 
     return 0;
@@ -0,0 +1,36 @@
+#include "triple_buffer.h"
+
+#include <string.h>
+
+void triple_buffer_init(triple_buffer *buffer) {
+    memset(buffer->slots, 0, sizeof(buffer->slots));
+
+    buffer->back = 0;
+    atomic_init(&buffer->middle, 1);
+    buffer->front = 2;
+}
+
+chip_8_frame *triple_buffer_back(triple_buffer *buffer) {
+    return &buffer->slots[buffer->back];
+}
+
+void triple_buffer_publish(triple_buffer *buffer) {
+    // Release the written frame and take over whatever the middle held.
+    unsigned old = atomic_exchange_explicit(&buffer->middle,
+                                            buffer->back | TRIPLE_BUFFER_FRESH,
+                                            memory_order_acq_rel);
+    buffer->back = old & ~TRIPLE_BUFFER_FRESH;
+}
+
+const chip_8_frame *triple_buffer_acquire(triple_buffer *buffer) {
+    if (!(atomic_load_explicit(&buffer->middle, memory_order_relaxed) &
+          TRIPLE_BUFFER_FRESH)) {
+        return NULL;
+    }
+
+    unsigned old = atomic_exchange_explicit(&buffer->middle, buffer->front,
+                                            memory_order_acq_rel);
+    buffer->front = old & ~TRIPLE_BUFFER_FRESH;
+
+    return &buffer->slots[buffer->front];
+}
@@ -0,0 +1,74 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "chip_8.h"
+
+// Set in the shared index when it holds a frame the consumer has not seen.
+#define TRIPLE_BUFFER_FRESH 4
+
+/**
+ * A snapshot of the framebuffer.
+ */
+typedef struct chip_8_frame {
+    uint64_t rows[FB_HEIGHT];
+} chip_8_frame;
+
+/**
+ * A lock-free single-producer, single-consumer triple buffer of frames.
+ *
+ * The producer fills its back slot and publishes it by swapping it with the
+ * shared middle slot; the consumer takes the middle slot in exchange for its
+ * front slot only when it is fresh. Neither side ever waits, the consumer
+ * always gets the latest completed frame and never sees a frame twice or
+ * half-written.
+ */
+typedef struct triple_buffer {
+    chip_8_frame slots[3];
+
+    // Index of the middle slot, with TRIPLE_BUFFER_FRESH.
+    _Alignas(64) atomic_uint middle;
+
+    // Owned by the producer and by the consumer respectively.
+    _Alignas(64) unsigned back;
+    _Alignas(64) unsigned front;
+} triple_buffer;
+
+/**
+ * Initializes the triple buffer with three cleared slots.
+ *
+ * @param buffer The triple buffer.
+ */
+void triple_buffer_init(triple_buffer *buffer);
+
+/**
+ * Returns the slot the producer writes the next frame into.
+ *
+ * @param buffer The triple buffer.
+ * @return The back slot.
+ */
+chip_8_frame *triple_buffer_back(triple_buffer *buffer);
+
+/**
+ * Publishes the back slot as the latest frame.
+ *
+ * @param buffer The triple buffer.
+ */
+void triple_buffer_publish(triple_buffer *buffer);
+
+/**
+ * Takes the latest published frame, if there is one the consumer has not
+ * seen yet.
+ *
+ * The frame stays valid until the next successful call.
+ *
+ * @param buffer The triple buffer.
+ * @return The latest frame, or NULL if nothing was published since the last
+ *         call.
+ */
+const chip_8_frame *triple_buffer_acquire(triple_buffer *buffer);
+
+#endif // TRIPLE_BUFFER_H